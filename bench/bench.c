@@ -0,0 +1,316 @@
+#include "dk.h"
+
+#if defined(__APPLE__) || defined(__MACH__)
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#endif
+
+#if defined(__linux__) || defined(__unix__)
+#include <SDL.h>
+#include <SDL_image.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DK_COLOR_IMPLEMENTATION
+#include "dk_color.h"
+
+#define DK_PIXELBUFFER_IMPLEMENTATION
+#include "dk_pixelbuffer.h"
+
+#define DK_SIMULATION_IMPLEMENTATION
+#include "dk_simulation.h"
+
+//
+// Microbenchmarks for the pixel buffer, the brushes, the simulation and file
+// I/O. Every case runs at several fill densities, the frame is filled again
+// (untimed) before every sample so each one starts from the same state.
+//
+//   bench [--runs N] [--size WxH] [--json] [--filter NAME]
+//
+// Prints one line per case and density as CSV (or a JSON array), with min,
+// median and p99 in microseconds, so two builds can be diffed.
+//
+
+#define BENCH_BATCH 1000
+#define BENCH_FILE_PSB "bench.psb"
+#define BENCH_FILE_PNG "bench.png"
+
+typedef struct
+{
+  pixel_buffer_t buffer;
+  u32 width;
+  u32 height;
+  u32 density; // percent of filled cells
+  u32 param;   // brush radius / size, batch size
+  dk_rng_t rng;
+} bench_state_t;
+
+typedef void (*bench_fn)(bench_state_t* state);
+
+typedef struct
+{
+  const char* name;
+  bench_fn setup; // untimed, before every sample
+  bench_fn run;   // timed
+  u32 params[4];  // one row per non zero entry
+} bench_case_t;
+
+static const u32 bench_densities[] = { 0, 10, 50, 100 };
+
+pixel_t
+bench_random_pixel(bench_state_t* state)
+{
+  u64 value = dk_rng_next(&state->rng);
+  pixel_t pixel = { 0 };
+  pixel.col = dk_rng_range(value, state->width);
+  pixel.row = dk_rng_range(dk_rng_next(&state->rng), state->height);
+  pixel.type = (pixel_type_t)(value % PIXEL_TYPE_COUNT);
+  pixel.color = pixel_type_to_color(pixel.type);
+  return pixel;
+}
+
+pixel_t
+bench_center_pixel(bench_state_t* state)
+{
+  pixel_t pixel = { 0 };
+  pixel.col = state->width / 2;
+  pixel.row = state->height / 2;
+  pixel.type = PIXEL_TYPE_SAND;
+  pixel.color = pixel_type_to_color(pixel.type);
+  return pixel;
+}
+
+// same cells for the same density on every sample and every build
+void
+bench_fill(bench_state_t* state)
+{
+  // loading a file sizes the frame to fit its pixels, put the bench size back
+  pixel_buffer_clear(&state->buffer);
+  pixel_buffer_resize(&state->buffer, state->width, state->height);
+  pixel_buffer_wake_all(&state->buffer);
+
+  dk_rng_t fill = dk_rng_create(state->density);
+  for (u32 row = 0; row < state->height; row++) {
+    for (u32 col = 0; col < state->width; col++) {
+      u64 value = dk_rng_at(fill, (u64)row * state->width + col);
+      if (dk_rng_range(value, 100) < state->density) {
+        pixel_t pixel = { 0 };
+        pixel.col = col;
+        pixel.row = row;
+        pixel.type = (pixel_type_t)((value & 0xff) % PIXEL_TYPE_COUNT);
+        pixel.color = pixel_type_to_color(pixel.type);
+        pixel_buffer_add(&state->buffer, pixel);
+      }
+    }
+  }
+
+  state->rng = dk_rng_create(~(u64)state->density);
+}
+
+void
+bench_fill_and_save(bench_state_t* state)
+{
+  bench_fill(state);
+  pixel_buffer_save(&state->buffer, BENCH_FILE_PSB);
+}
+
+void
+bench_add(bench_state_t* state)
+{
+  for (u32 i = 0; i < state->param; i++) {
+    pixel_buffer_add(&state->buffer, bench_random_pixel(state));
+  }
+}
+
+void
+bench_remove_all(bench_state_t* state)
+{
+  for (u32 i = 0; i < state->param; i++) {
+    pixel_t pixel = bench_random_pixel(state);
+    pixel_buffer_remove_all(&state->buffer, pixel.col, pixel.row);
+  }
+}
+
+void
+bench_circle(bench_state_t* state)
+{
+  pixel_buffer_add_circle(&state->buffer, bench_center_pixel(state), state->param, false);
+}
+
+void
+bench_circle_erase(bench_state_t* state)
+{
+  pixel_buffer_add_circle(&state->buffer, bench_center_pixel(state), state->param, true);
+}
+
+void
+bench_line(bench_state_t* state)
+{
+  pixel_t pixel = bench_center_pixel(state);
+  pixel.col -= MIN(state->param, state->width) / 2;
+  pixel_buffer_add_line(&state->buffer, pixel, state->param, 0, false);
+}
+
+void
+bench_rect(bench_state_t* state)
+{
+  pixel_buffer_add_rect(&state->buffer, bench_center_pixel(state), state->param, state->param, false);
+}
+
+void
+bench_rect_outline(bench_state_t* state)
+{
+  pixel_buffer_add_rect_outline(&state->buffer, bench_center_pixel(state), state->param, state->param, false);
+}
+
+void
+bench_simulation(bench_state_t* state)
+{
+  update_pixel_simulation(&state->buffer);
+}
+
+void
+bench_save(bench_state_t* state)
+{
+  pixel_buffer_save(&state->buffer, BENCH_FILE_PSB);
+}
+
+void
+bench_load(bench_state_t* state)
+{
+  pixel_buffer_load(&state->buffer, BENCH_FILE_PSB);
+}
+
+void
+bench_save_png(bench_state_t* state)
+{
+  pixel_buffer_save_png(&state->buffer, BENCH_FILE_PNG, state->param);
+}
+
+// 1x, 4x and 8x from one pass
+void
+bench_save_pngs(bench_state_t* state)
+{
+  const char* filenames[] = { BENCH_FILE_PNG, BENCH_FILE_PNG, BENCH_FILE_PNG };
+  const u32 scales[] = { 1, 4, 8 };
+  pixel_buffer_save_pngs(&state->buffer, filenames, scales, 3);
+}
+
+static const bench_case_t bench_cases[] = {
+  { "pixel_buffer_add", bench_fill, bench_add, { BENCH_BATCH } },
+  { "pixel_buffer_remove_all", bench_fill, bench_remove_all, { BENCH_BATCH } },
+  { "pixel_buffer_add_circle", bench_fill, bench_circle, { 2, 8, 32, 128 } },
+  { "pixel_buffer_add_circle_erase", bench_fill, bench_circle_erase, { 2, 8, 32, 128 } },
+  { "pixel_buffer_add_line", bench_fill, bench_line, { 2, 8, 32, 128 } },
+  { "pixel_buffer_add_rect", bench_fill, bench_rect, { 2, 8, 32, 128 } },
+  { "pixel_buffer_add_rect_outline", bench_fill, bench_rect_outline, { 2, 8, 32, 128 } },
+  { "update_pixel_simulation", bench_fill, bench_simulation, { 1 } },
+  { "pixel_buffer_save", bench_fill, bench_save, { 1 } },
+  { "pixel_buffer_load", bench_fill_and_save, bench_load, { 1 } },
+  { "pixel_buffer_save_png", bench_fill, bench_save_png, { 1, 4, 8 } },
+  { "pixel_buffer_save_pngs", bench_fill, bench_save_pngs, { 1 } },
+};
+
+int
+bench_compare(const void* a, const void* b)
+{
+  f64 x = *(const f64*)a;
+  f64 y = *(const f64*)b;
+  return (x > y) - (x < y);
+}
+
+int
+main(int argc, char const* argv[])
+{
+  u32 runs = 50;
+  u32 width = 256;
+  u32 height = 256;
+  bool json = false;
+  const char* filter = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = (u32)atoi(argv[++i]);
+      runs = MAX(runs, 1);
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+        fprintf(stderr, "bench: --size expects WxH\n");
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    }
+  }
+
+  // one thread, the numbers should not depend on the machine's core count
+  dk_simulation_set_thread_count(1);
+
+  bench_state_t state = { .width = width, .height = height };
+  pixel_buffer_init_size(&state.buffer, width, height);
+
+  f64* samples = (f64*)malloc(sizeof(f64) * runs);
+  f64 frequency = (f64)SDL_GetPerformanceFrequency();
+  bool first = true;
+
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("name,param,density,width,height,runs,min_us,median_us,p99_us\n");
+  }
+
+  for (u32 c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++) {
+    const bench_case_t* bench = &bench_cases[c];
+    if (filter != NULL && strstr(bench->name, filter) == NULL) {
+      continue;
+    }
+
+    for (u32 p = 0; p < 4 && bench->params[p] != 0; p++) {
+      for (u32 d = 0; d < sizeof(bench_densities) / sizeof(bench_densities[0]); d++) {
+        state.param = bench->params[p];
+        state.density = bench_densities[d];
+
+        for (u32 r = 0; r < runs; r++) {
+          bench->setup(&state);
+          u64 start = SDL_GetPerformanceCounter();
+          bench->run(&state);
+          u64 end = SDL_GetPerformanceCounter();
+          samples[r] = (f64)(end - start) * 1e6 / frequency;
+        }
+
+        qsort(samples, runs, sizeof(f64), bench_compare);
+        f64 min = samples[0];
+        f64 median = samples[runs / 2];
+        f64 p99 = samples[(runs * 99 + 99) / 100 - 1];
+
+        if (json) {
+          printf("%s  { \"name\": \"%s\", \"param\": %u, \"density\": %u, \"width\": %u, \"height\": %u, "
+                 "\"runs\": %u, \"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f }",
+                 first ? "" : ",\n", bench->name, state.param, state.density, width, height,
+                 runs, min, median, p99);
+        } else {
+          printf("%s,%u,%u,%u,%u,%u,%.3f,%.3f,%.3f\n",
+                 bench->name, state.param, state.density, width, height, runs, min, median, p99);
+        }
+        fflush(stdout);
+        first = false;
+      }
+    }
+  }
+
+  if (json) {
+    printf("\n]\n");
+  }
+
+  remove(BENCH_FILE_PSB);
+  remove(BENCH_FILE_PNG);
+  free(samples);
+  pixel_buffer_destroy(&state.buffer);
+  dk_simulation_destroy();
+
+  return EXIT_SUCCESS;
+}
@@ -398,54 +398,185 @@ dk_stack_resize(dk_stack_t* stack, i32 new_capacity)
   stack->capacity = new_capacity;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// ATOMICS
+// Lock free min/max, used where several threads may widen the same range.
+//
+
+internal void
+dk_atomic_store_u32(u32* target, u32 value)
+{
+  __atomic_store_n(target, value, __ATOMIC_RELAXED);
+}
+
+internal void
+dk_atomic_min_u32(u32* target, u32 value)
+{
+  u32 current = __atomic_load_n(target, __ATOMIC_RELAXED);
+  while (value < current &&
+         !__atomic_compare_exchange_n(
+           target, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+internal void
+dk_atomic_max_u32(u32* target, u32 value)
+{
+  u32 current = __atomic_load_n(target, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(
+           target, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RANDOM
+// Counter based generator: the n-th number of a stream is a hash of the seed
+// and n, so it can be computed in any order and on any thread and still give
+// the same sequence. Streams are split off by hashing a stream id into the
+// seed, e.g. one stream per tick and a counter per cell.
+//
+
+typedef struct
+{
+  u64 seed;
+  u64 counter;
+} dk_rng_t;
+
+// splitmix64 finalizer
+internal inline u64
+dk_hash_u64(u64 x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+internal inline dk_rng_t
+dk_rng_create(u64 seed)
+{
+  return (dk_rng_t){ .seed = dk_hash_u64(seed), .counter = 0 };
+}
+
+internal inline dk_rng_t
+dk_rng_split(dk_rng_t rng, u64 stream)
+{
+  return (dk_rng_t){ .seed = dk_hash_u64(rng.seed ^ dk_hash_u64(stream + 0x9e3779b97f4a7c15ULL)), .counter = 0 };
+}
+
+internal inline u64
+dk_rng_at(dk_rng_t rng, u64 counter)
+{
+  return dk_hash_u64(rng.seed + counter * 0x9e3779b97f4a7c15ULL);
+}
+
+internal inline u64
+dk_rng_next(dk_rng_t* rng)
+{
+  return dk_rng_at(*rng, rng->counter++);
+}
+
+// [0, bound), bound must not be zero
+internal inline u32
+dk_rng_range(u64 value, u32 bound)
+{
+  return (u32)(((value >> 32) * bound) >> 32);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // MEMORY ARENA IMPLEMENTATION
+// Bump allocator over a chain of blocks. A full block is never moved, a new
+// block at least twice as big is chained in front of it, so pointers stay
+// valid until the arena is reset or freed. Allocations are 16 byte aligned.
 //
 
+typedef struct dk_memory_block_t
+{
+  struct dk_memory_block_t* prev;
+  sz_t capacity;
+  sz_t size;
+} dk_memory_block_t;
+
 typedef struct
 {
-  i32* data;
-  i32 capacity;
-  i32 size;
+  dk_memory_block_t* block; // newest and biggest block
+  sz_t used;                // bytes handed out since the last reset
 } dk_memory_arena_t;
 
+#define DK_MEMORY_ARENA_ALIGN 16
+#define DK_MEMORY_ARENA_HEADER                                                 \
+  ((sizeof(dk_memory_block_t) + DK_MEMORY_ARENA_ALIGN - 1) &                   \
+   ~(sz_t)(DK_MEMORY_ARENA_ALIGN - 1))
+
+internal dk_memory_block_t*
+dk_memory_arena__block(dk_memory_block_t* prev, sz_t capacity)
+{
+  dk_memory_block_t* block =
+    (dk_memory_block_t*)dk_malloc(DK_MEMORY_ARENA_HEADER + capacity);
+  block->prev = prev;
+  block->capacity = capacity;
+  block->size = 0;
+  return block;
+}
+
 internal dk_memory_arena_t*
-dk_memory_arena_create(i32 capacity)
+dk_memory_arena_create(sz_t capacity)
 {
   dk_memory_arena_t* arena =
     (dk_memory_arena_t*)dk_malloc(sizeof(dk_memory_arena_t));
-  arena->capacity = capacity;
-  arena->size = 0;
-  arena->data = (i32*)dk_malloc(sizeof(i32) * capacity);
+  arena->block = dk_memory_arena__block(NULL, capacity);
+  arena->used = 0;
   return arena;
 }
 
-internal i32*
-dk_memory_arena_next_ptr(dk_memory_arena_t* arena, i32 size)
+internal void*
+dk_memory_arena_alloc(dk_memory_arena_t* arena, sz_t size)
 {
-  i32* ptr = arena->data + arena->size;
-  arena->size += size;
+  size = (size + DK_MEMORY_ARENA_ALIGN - 1) & ~(sz_t)(DK_MEMORY_ARENA_ALIGN - 1);
+
+  dk_memory_block_t* block = arena->block;
+  if (block->size + size > block->capacity) {
+    sz_t capacity = block->capacity * 2;
+    block = dk_memory_arena__block(block, capacity > size ? capacity : size);
+    arena->block = block;
+  }
+
+  void* ptr = (u8*)block + DK_MEMORY_ARENA_HEADER + block->size;
+  block->size += size;
+  arena->used += size;
   return ptr;
 }
 
+// Everything handed out so far becomes invalid. Only the newest block, the
+// biggest one, is kept.
 internal void
 dk_memory_arena_reset(dk_memory_arena_t* arena)
 {
-  arena->size = 0;
-}
+  dk_memory_block_t* block = arena->block->prev;
+  while (block != NULL) {
+    dk_memory_block_t* prev = block->prev;
+    dk_free(block);
+    block = prev;
+  }
 
-internal void
-dk_memory_arena_free(dk_memory_arena_t* arena)
-{
-  free(arena->data);
-  free(arena);
+  arena->block->prev = NULL;
+  arena->block->size = 0;
+  arena->used = 0;
 }
 
 internal void
-dk_memory_arena_resize(dk_memory_arena_t* arena, i32 new_capacity)
+dk_memory_arena_free(dk_memory_arena_t* arena)
 {
-  arena->data = (i32*)dk_realloc(arena->data, new_capacity);
-  arena->capacity = new_capacity;
+  dk_memory_block_t* block = arena->block;
+  while (block != NULL) {
+    dk_memory_block_t* prev = block->prev;
+    dk_free(block);
+    block = prev;
+  }
+  dk_free(arena);
 }
 
 internal void
@@ -497,4 +628,104 @@ dk_read_file(cstr p_filename, u32* p_size)
   return p_data;
 }
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only into memory: its pages are read in as `data`
+// is touched, nothing is copied. Empty files map to NULL with size 0.
+typedef struct
+{
+  const u8* data;
+  sz_t size;
+#if defined(_WIN32)
+  HANDLE mapping;
+#endif
+} dk_file_map_t;
+
+internal bool
+dk_file_map(cstr filename, dk_file_map_t* map)
+{
+  map->data = NULL;
+  map->size = 0;
+#if defined(_WIN32)
+  map->mapping = NULL;
+
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+  if (size.QuadPart == 0) {
+    CloseHandle(file);
+    return true;
+  }
+
+  // the view keeps the file open, the handles are not needed past this
+  map->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (map->mapping == NULL) {
+    return false;
+  }
+  map->data = (const u8*)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (map->data == NULL) {
+    CloseHandle(map->mapping);
+    map->mapping = NULL;
+    return false;
+  }
+  map->size = (sz_t)size.QuadPart;
+#else
+  int file = open(filename, O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(file, &info) != 0 || info.st_size < 0) {
+    close(file);
+    return false;
+  }
+  if (info.st_size == 0) {
+    close(file);
+    return true;
+  }
+
+  // the mapping keeps the file open, the descriptor is not needed past this
+  void* data = mmap(NULL, (sz_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  map->data = (const u8*)data;
+  map->size = (sz_t)info.st_size;
+#endif
+  return true;
+}
+
+internal void
+dk_file_unmap(dk_file_map_t* map)
+{
+  if (map->data != NULL) {
+#if defined(_WIN32)
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+    map->mapping = NULL;
+#else
+    munmap((void*)map->data, map->size);
+#endif
+  }
+  map->data = NULL;
+  map->size = 0;
+}
+
 #endif // __DK_H__
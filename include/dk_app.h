@@ -3,11 +3,13 @@
 
 #include <SDL2/SDL.h>
 #include "dk_text.h"
+#include "dk_batch.h"
 
 typedef struct
 {
   i32 x;
   i32 y;
+  i32 zoom; // screen pixels per cell
 } app_camera_t;
 
 typedef struct
@@ -33,6 +35,23 @@ typedef struct
   int y;
 } app_mouse_t;
 
+// Mouse positions reported while the left button is held, in window
+// coordinates and in the order they came in. Painting draws through all of
+// them, not just where the cursor is when the frame starts.
+#define APP_STROKE_SAMPLES 256
+
+typedef struct
+{
+  i32 x;
+  i32 y;
+} app_stroke_sample_t;
+
+typedef struct
+{
+  app_stroke_sample_t samples[APP_STROKE_SAMPLES];
+  u32 count; // emptied every frame by game_update
+} app_stroke_t;
+
 typedef struct
 {
   SDL_Window* window;
@@ -40,14 +59,25 @@ typedef struct
   SDL_Event event;
   bool running;
   bool ui_focused;
+  // frames left to draw before the loop may sleep again, see app_wake
+  u32 redraw_frames;
+  // the renderer waits for vsync on present, no need to sleep on top of it
+  bool vsync;
   u32 state;
   dk_text_t text;
   dk_text_t ui_text;
+  // what the widgets of the frame look like, drawn at the end of it
+  dk_batch_t ui_batch;
   app_state_t game_state;
   app_stats_t stats;
   app_mouse_t mouse;
+  app_stroke_t stroke;
   app_camera_t camera;
 } app_t;
 
+// Wakes the main loop from an idle wait, safe to call from any thread.
+// Defined by the application.
+void
+app_wake(void);
 
 #endif // DK_APP_H
@@ -0,0 +1,164 @@
+#if !defined(DK_BATCH_H)
+#define DK_BATCH_H
+
+#include <SDL2/SDL.h>
+
+#include "dk.h"
+
+// quad batch
+//
+// Collects textured and solid quads and draws each run of quads that share a
+// texture with one SDL_RenderGeometry call. Quads come out in the order they
+// were added: adding one with another texture first draws the ones waiting.
+typedef struct
+{
+  SDL_Renderer* renderer;
+  // texture of the quads waiting, NULL for solid colored ones
+  SDL_Texture* texture;
+  i32 texture_width;
+  i32 texture_height;
+  SDL_Vertex* vertices;
+  int* indices;
+  u32 count;
+  u32 capacity;
+  // SDL_RenderGeometry calls made, for the stats overlay and benchmarks
+  u32 draw_calls;
+} dk_batch_t;
+
+void
+dk_batch_init(dk_batch_t* batch, SDL_Renderer* renderer);
+
+void
+dk_batch_rect(dk_batch_t* batch, SDL_Rect rect, SDL_Color color);
+
+void
+dk_batch_image(dk_batch_t* batch, SDL_Texture* texture, SDL_Rect source, SDL_Rect rect, SDL_Color color);
+
+void
+dk_batch_flush(dk_batch_t* batch);
+
+void
+dk_batch_clear(dk_batch_t* batch);
+
+void
+dk_batch_destroy(dk_batch_t* batch);
+
+#if defined(DK_BATCH_IMPLEMENTATION)
+
+void
+dk_batch_init(dk_batch_t* batch, SDL_Renderer* renderer)
+{
+  batch->renderer = renderer;
+  batch->texture = NULL;
+  batch->texture_width = 1;
+  batch->texture_height = 1;
+  batch->vertices = NULL;
+  batch->indices = NULL;
+  batch->count = 0;
+  batch->capacity = 0;
+  batch->draw_calls = 0;
+}
+
+void
+dk_batch_flush(dk_batch_t* batch)
+{
+  if (batch->count > 0) {
+    SDL_RenderGeometry(batch->renderer,
+                       batch->texture,
+                       batch->vertices,
+                       (int)batch->count * 4,
+                       batch->indices,
+                       (int)batch->count * 6);
+    batch->draw_calls++;
+    batch->count = 0;
+  }
+}
+
+// drops the quads waiting without drawing them
+void
+dk_batch_clear(dk_batch_t* batch)
+{
+  batch->count = 0;
+}
+
+// the quads added next use `texture`, the ones waiting for another are drawn
+internal void
+dk_batch__use(dk_batch_t* batch, SDL_Texture* texture)
+{
+  if (texture != batch->texture) {
+    dk_batch_flush(batch);
+    batch->texture = texture;
+    batch->texture_width = 1;
+    batch->texture_height = 1;
+    if (texture != NULL) {
+      SDL_QueryTexture(texture, NULL, NULL, &batch->texture_width, &batch->texture_height);
+    }
+  }
+}
+
+internal void
+dk_batch__quad(dk_batch_t* batch, SDL_Rect rect, f32 u0, f32 v0, f32 u1, f32 v1, SDL_Color color)
+{
+  if (batch->count == batch->capacity) {
+    batch->capacity = MAX(64, batch->capacity * 2);
+    batch->vertices = (SDL_Vertex*)realloc(batch->vertices, sizeof(SDL_Vertex) * 4 * batch->capacity);
+    batch->indices = (int*)realloc(batch->indices, sizeof(int) * 6 * batch->capacity);
+  }
+
+  f32 left = (f32)rect.x;
+  f32 top = (f32)rect.y;
+  f32 right = (f32)(rect.x + rect.w);
+  f32 bottom = (f32)(rect.y + rect.h);
+
+  SDL_Vertex* vertex = &batch->vertices[batch->count * 4];
+  vertex[0] = (SDL_Vertex){ { left, top }, color, { u0, v0 } };
+  vertex[1] = (SDL_Vertex){ { right, top }, color, { u1, v0 } };
+  vertex[2] = (SDL_Vertex){ { right, bottom }, color, { u1, v1 } };
+  vertex[3] = (SDL_Vertex){ { left, bottom }, color, { u0, v1 } };
+
+  int* index = &batch->indices[batch->count * 6];
+  int first = (int)batch->count * 4;
+  index[0] = first;
+  index[1] = first + 1;
+  index[2] = first + 2;
+  index[3] = first;
+  index[4] = first + 2;
+  index[5] = first + 3;
+
+  batch->count++;
+}
+
+void
+dk_batch_rect(dk_batch_t* batch, SDL_Rect rect, SDL_Color color)
+{
+  dk_batch__use(batch, NULL);
+  dk_batch__quad(batch, rect, 0, 0, 0, 0, color);
+}
+
+// `source` in texels of `texture`, tinted by `color` like SDL_SetTextureColorMod
+void
+dk_batch_image(dk_batch_t* batch, SDL_Texture* texture, SDL_Rect source, SDL_Rect rect, SDL_Color color)
+{
+  dk_batch__use(batch, texture);
+
+  f32 width = (f32)batch->texture_width;
+  f32 height = (f32)batch->texture_height;
+  dk_batch__quad(batch,
+                 rect,
+                 (f32)source.x / width,
+                 (f32)source.y / height,
+                 (f32)(source.x + source.w) / width,
+                 (f32)(source.y + source.h) / height,
+                 color);
+}
+
+void
+dk_batch_destroy(dk_batch_t* batch)
+{
+  free(batch->vertices);
+  free(batch->indices);
+  dk_batch_init(batch, batch->renderer);
+}
+
+#endif // DK_BATCH_IMPLEMENTATION
+#endif // DK_BATCH_H
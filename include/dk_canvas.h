@@ -0,0 +1,239 @@
+#if !defined(DK_CANVAS_H)
+#define DK_CANVAS_H
+
+#include <SDL2/SDL.h>
+
+#include "dk.h"
+#include "dk_app.h"
+#include "dk_macros.h"
+#include "dk_pixelbuffer.h"
+
+// canvas renderer
+//
+// Mirrors a frame in a streaming texture with one texel per cell. A draw
+// uploads the chunk rows that changed since the last one (see
+// pixel_chunk_t.changed) and puts the whole frame on screen with one scaled
+// SDL_RenderCopy, so what it costs depends on how much changed, not on how
+// many particles there are.
+typedef struct
+{
+  SDL_Renderer* renderer;
+  SDL_Texture* texture;
+  // texture size in cells
+  u32 width;
+  u32 height;
+  // frame the texture holds, switching frames uploads the new one whole
+  pixel_buffer_t* buffer;
+  // one band of chunk rows in texture format, the source of every upload
+  u32* pixels;
+  // grid overlay, one 1px wide rect per line relative to the canvas corner,
+  // built for one zoom and frame size
+  SDL_Rect* grid_lines;
+  SDL_Rect* grid_visible; // lines on screen this frame, where they are
+  u32 grid_line_count;
+  u32 grid_width;
+  u32 grid_height;
+  i32 grid_zoom;
+} dk_canvas_t;
+
+void
+dk_canvas_init(dk_canvas_t* canvas, SDL_Renderer* renderer);
+
+void
+dk_canvas_draw(dk_canvas_t* canvas, pixel_buffer_t* buffer, app_camera_t* camera);
+
+void
+dk_canvas_draw_grid(dk_canvas_t* canvas, pixel_buffer_t* buffer, app_camera_t* camera);
+
+void
+dk_canvas_destroy(dk_canvas_t* canvas);
+
+#if defined(DK_CANVAS_IMPLEMENTATION)
+
+void
+dk_canvas_init(dk_canvas_t* canvas, SDL_Renderer* renderer)
+{
+  canvas->renderer = renderer;
+  canvas->texture = NULL;
+  canvas->width = 0;
+  canvas->height = 0;
+  canvas->buffer = NULL;
+  canvas->pixels = NULL;
+  canvas->grid_lines = NULL;
+  canvas->grid_visible = NULL;
+  canvas->grid_line_count = 0;
+  canvas->grid_width = 0;
+  canvas->grid_height = 0;
+  canvas->grid_zoom = 0;
+}
+
+internal void
+dk_canvas__free_texture(dk_canvas_t* canvas)
+{
+  if (canvas->texture != NULL) {
+    SDL_DestroyTexture(canvas->texture);
+  }
+  free(canvas->pixels);
+  canvas->texture = NULL;
+  canvas->pixels = NULL;
+  canvas->buffer = NULL;
+}
+
+void
+dk_canvas_destroy(dk_canvas_t* canvas)
+{
+  dk_canvas__free_texture(canvas);
+  free(canvas->grid_lines);
+  free(canvas->grid_visible);
+  dk_canvas_init(canvas, canvas->renderer);
+}
+
+// (re)creates the texture when the frame size changed, false when the
+// renderer cannot make one that big (asked once per size)
+internal bool
+dk_canvas__fit(dk_canvas_t* canvas, pixel_buffer_t* buffer)
+{
+  if (canvas->width == buffer->width && canvas->height == buffer->height) {
+    return canvas->texture != NULL;
+  }
+
+  dk_canvas__free_texture(canvas);
+  canvas->width = buffer->width;
+  canvas->height = buffer->height;
+
+  // RGBA8888 is the packed 0xRRGGBBAA of pixel__pack_color, empty cells are
+  // 0, fully transparent, and show the canvas background
+  canvas->texture = SDL_CreateTexture(canvas->renderer,
+                                      SDL_PIXELFORMAT_RGBA8888,
+                                      SDL_TEXTUREACCESS_STREAMING,
+                                      (int)buffer->width,
+                                      (int)buffer->height);
+  if (canvas->texture == NULL) {
+    SDL_Log("SDL_CreateTexture Error: %s ", SDL_GetError());
+    return false;
+  }
+  SDL_SetTextureBlendMode(canvas->texture, SDL_BLENDMODE_BLEND);
+
+  canvas->pixels = (u32*)malloc(sizeof(u32) * buffer->width * GRID_CHUNK_SIZE);
+  return true;
+}
+
+void
+dk_canvas_draw(dk_canvas_t* canvas, pixel_buffer_t* buffer, app_camera_t* camera)
+{
+  if (buffer->cells == NULL) {
+    return;
+  }
+
+  // bigger than the GPU allows, draw the cells one by one
+  if (!dk_canvas__fit(canvas, buffer)) {
+    pixel_buffer_draw(buffer, camera, canvas->renderer);
+    return;
+  }
+
+  bool upload_all = canvas->buffer != buffer;
+  canvas->buffer = buffer;
+
+  u32 palette[PIXEL_PALETTE_SIZE];
+  for (u32 i = 0; i < buffer->palette_count; i++) {
+    palette[i] = pixel__pack_color(buffer->palette[i]);
+  }
+
+  // one upload per chunk row, spanning its first to its last changed chunk
+  for (u32 chunk_row = 0; chunk_row < buffer->chunk_rows; chunk_row++) {
+    u32 first = buffer->chunk_cols;
+    u32 last = 0;
+    for (u32 chunk_col = 0; chunk_col < buffer->chunk_cols; chunk_col++) {
+      pixel_chunk_t* chunk = pixel_buffer_chunk(buffer, chunk_col, chunk_row);
+      if (chunk->changed || upload_all) {
+        first = MIN(first, chunk_col);
+        last = chunk_col;
+        chunk->changed = 0;
+      }
+    }
+
+    if (first > last) {
+      continue;
+    }
+
+    SDL_Rect rect = {
+      .x = (i32)(first * GRID_CHUNK_SIZE),
+      .y = (i32)(chunk_row * GRID_CHUNK_SIZE),
+      .w = (i32)(MIN((last + 1) * GRID_CHUNK_SIZE, buffer->width) - first * GRID_CHUNK_SIZE),
+      .h = (i32)(MIN((chunk_row + 1) * GRID_CHUNK_SIZE, buffer->height) - chunk_row * GRID_CHUNK_SIZE),
+    };
+
+    u32 width = (u32)rect.w;
+    u32 height = (u32)rect.h;
+    for (u32 y = 0; y < height; y++) {
+      u32 cell = ((u32)rect.y + y) * buffer->width + (u32)rect.x;
+      u32* pixels = canvas->pixels + y * width;
+      for (u32 x = 0; x < width; x++) {
+        pixels[x] = buffer->cells[cell + x] == GRID_CELL_EMPTY ? 0 : palette[buffer->colors[cell + x]];
+      }
+    }
+
+    SDL_UpdateTexture(canvas->texture, &rect, canvas->pixels, rect.w * (i32)sizeof(u32));
+  }
+
+  i32 zoom = camera->zoom;
+  SDL_Rect rect = {
+    .x = (WINDOW_WIDTH - (i32)buffer->width * zoom) / 2 + camera->x,
+    .y = (WINDOW_HEIGHT - (i32)buffer->height * zoom) / 2 + camera->y,
+    .w = (i32)buffer->width * zoom,
+    .h = (i32)buffer->height * zoom,
+  };
+  SDL_RenderCopy(canvas->renderer, canvas->texture, NULL, &rect);
+}
+
+// Lines left of every column and above every row, in the current draw color
+// and under the cells. The line list only changes with the zoom or the frame
+// size, every frame just moves the lines that are on screen by the camera and
+// hands them to the renderer in one call.
+void
+dk_canvas_draw_grid(dk_canvas_t* canvas, pixel_buffer_t* buffer, app_camera_t* camera)
+{
+  i32 zoom = camera->zoom;
+  if (zoom < GRID_LINES_MIN_ZOOM) {
+    return;
+  }
+
+  if (canvas->grid_lines == NULL || canvas->grid_zoom != zoom ||
+      canvas->grid_width != buffer->width || canvas->grid_height != buffer->height) {
+    free(canvas->grid_lines);
+    free(canvas->grid_visible);
+    canvas->grid_line_count = buffer->width + buffer->height;
+    canvas->grid_lines = (SDL_Rect*)malloc(sizeof(SDL_Rect) * canvas->grid_line_count);
+    canvas->grid_visible = (SDL_Rect*)malloc(sizeof(SDL_Rect) * canvas->grid_line_count);
+    canvas->grid_width = buffer->width;
+    canvas->grid_height = buffer->height;
+    canvas->grid_zoom = zoom;
+
+    i32 width = (i32)buffer->width * zoom;
+    i32 height = (i32)buffer->height * zoom;
+    for (u32 col = 0; col < buffer->width; col++) {
+      canvas->grid_lines[col] = (SDL_Rect){ (i32)col * zoom, 0, 1, height + 1 };
+    }
+    for (u32 row = 0; row < buffer->height; row++) {
+      canvas->grid_lines[buffer->width + row] = (SDL_Rect){ 0, (i32)row * zoom, width + 1, 1 };
+    }
+  }
+
+  i32 origin_x = (WINDOW_WIDTH - (i32)buffer->width * zoom) / 2 + camera->x;
+  i32 origin_y = (WINDOW_HEIGHT - (i32)buffer->height * zoom) / 2 + camera->y;
+
+  i32 count = 0;
+  for (u32 i = 0; i < canvas->grid_line_count; i++) {
+    SDL_Rect line = canvas->grid_lines[i];
+    line.x += origin_x;
+    line.y += origin_y;
+    if (line.x + line.w > 0 && line.x < WINDOW_WIDTH && line.y + line.h > 0 && line.y < WINDOW_HEIGHT) {
+      canvas->grid_visible[count++] = line;
+    }
+  }
+
+  SDL_RenderFillRects(canvas->renderer, canvas->grid_visible, count);
+}
+
+#endif // DK_CANVAS_IMPLEMENTATION
+#endif // DK_CANVAS_H
@@ -29,10 +29,10 @@ dk_clipboard_clear(dk_clipboard_t* clipboard) {
 
 void
 dk_clipboard_set(dk_clipboard_t* clipboard, pixel_buffer_t* buffer) {
-  if (clipboard == NULL) {
-    pixel_buffer_clear(clipboard);
-  }
-  memcpy(clipboard, buffer, sizeof(pixel_buffer_t));
+  // deep copy, the clipboard must not share storage with the frame
+  pixel_buffer_clear(clipboard);
+  pixel_buffer_resize(clipboard, buffer->width, buffer->height);
+  pixel_buffer_merge(clipboard, buffer);
 }
 
 pixel_buffer_t*
@@ -42,20 +42,7 @@ dk_clipboard_get(dk_clipboard_t* clipboard) {
 
 void
 dk_clipboard_paste_to_buffer(dk_clipboard_t* clipboard, pixel_buffer_t* buffer) {
-
-  pixel_buffer_t* temp = (pixel_buffer_t*)malloc(sizeof(pixel_buffer_t));
-  temp->count = buffer->count;
-  temp->pixels = (pixel_t*)malloc(sizeof(pixel_t) * temp->count);
-  memcpy(temp->pixels, buffer->pixels, sizeof(pixel_t) * temp->count);
-
-  pixel_buffer_merge(temp, clipboard);
-
-  buffer->count = temp->count;
-  buffer->pixels = (pixel_t*)malloc(sizeof(pixel_t) * buffer->count);
-  memcpy(buffer->pixels, temp->pixels, sizeof(pixel_t) * temp->count);
-
-  free(temp->pixels);
-  free(temp);
+  pixel_buffer_merge(buffer, clipboard);
 }
 
 #endif // DK_CLIPBOARD_IMPLEMENTATION
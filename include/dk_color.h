@@ -37,6 +37,9 @@
 #define C64_LIGHT_PINK (SDL_Color){ 255, 153, 204, 255 }
 #define C64_LIGHT_OLIVE (SDL_Color){ 153, 153, 51, 255 }
 
+// the colors above in the order of the palette buttons
+extern SDL_Color C64_COLORS[C64_COLOR_COUNT];
+
 void
 load_colors(SDL_Color* buffer);
 
@@ -43,10 +43,13 @@ typedef enum icon_type
   ICON_COUNT
 } icon_type_t;
 
+// An icon is a tile of the tileset texture, every icon draws from that one
+// texture so a toolbar full of them is a single batch (see dk_ui_icon_button).
 typedef struct
 {
   SDL_Rect rect;
-  SDL_Texture* texture;
+  SDL_Texture* texture; // the tileset's
+  SDL_Rect source;      // tile in the tileset
   icon_type_t type;
 } icon_t;
 
@@ -98,26 +101,21 @@ load_tileset(SDL_Renderer* renderer, tileset_t* tileset, char* path)
 
   tileset->rect.x = 0;
   tileset->rect.y = 0;
+
+  SDL_SetTextureBlendMode(tileset->texture, SDL_BLENDMODE_BLEND);
 }
 
 void get_icon_from_tileset(SDL_Renderer* renderer, tileset_t* tileset, icon_t* icon, SDL_Point coords)
 {
+  (void)renderer;
 
-  icon->rect.w = 16;
-  icon->rect.h = 16;
-
-  icon->rect.x = coords.x * 16;
-  icon->rect.y = coords.y * 16;
-
-  icon->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, 16, 16);
-
-  SDL_SetRenderTarget(renderer, icon->texture);
-
-  SDL_RenderCopy(renderer, tileset->texture, &icon->rect, NULL);
+  icon->source.w = 16;
+  icon->source.h = 16;
 
-  SDL_SetRenderTarget(renderer, NULL);
+  icon->source.x = coords.x * 16;
+  icon->source.y = coords.y * 16;
 
-  SDL_SetTextureBlendMode(icon->texture, SDL_BLENDMODE_BLEND);
+  icon->texture = tileset->texture;
 
   icon->rect.w = 32;
   icon->rect.h = 32;
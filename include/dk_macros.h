@@ -9,11 +9,26 @@ static int WINDOW_HEIGHT = 720;
 // #define GRID_WIDTH (WINDOW_WIDTH - 200) / GRID_CELL_SIZE
 // #define GRID_HEIGHT (WINDOW_HEIGHT - 200) / GRID_CELL_SIZE
 
+// size of a new canvas, loaded files and images bring their own
+// (pixel_buffer_t.width / height)
 #define GRID_WIDTH 72
 #define GRID_HEIGHT 52
 
+#define GRID_MAX_WIDTH 8192
+#define GRID_MAX_HEIGHT 8192
+
+// side of the square regions the simulation wakes and sleeps as one unit
+#define GRID_CHUNK_SIZE 16
+
+// smallest zoom the grid lines are drawn at, closer together than this they
+// cover most of the canvas and hide the cells instead of outlining them
+#define GRID_LINES_MIN_ZOOM 3
+
 #define FULLSCREEN 0
 
+// longest the main loop sleeps while idle, an event ends the wait earlier
+#define APP_IDLE_WAIT_MS 500
+
 #define GRID_CELL_EMPTY 0
 #define GRID_CELL_FILLED 1
 
@@ -2,6 +2,10 @@
 #define DK_PIXELBUFFER_H
 
 #include <assert.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
@@ -17,42 +21,162 @@ typedef enum {
   PIXEL_TYPE_COUNT
 } pixel_type_t;
 
+// A single cell as it is passed to and from a frame (brushes, lookups,
+// files). Frames do not store pixel_t, see pixel_buffer_t.
+typedef struct
+{
+  u32 col;
+  u32 row;
+  pixel_type_t type;
+  SDL_Color color;
+} pixel_t;
+
+// Colors one frame can hold, cells store an index into the frame's palette.
+#define PIXEL_PALETTE_SIZE 256
+
+// cell rectangle, max is exclusive and the rect is empty when min >= max
+typedef struct
+{
+  u32 min_col;
+  u32 min_row;
+  u32 max_col;
+  u32 max_row;
+} pixel_rect_t;
+
+#define PIXEL_RECT_EMPTY (pixel_rect_t){ UINT32_MAX, UINT32_MAX, 0, 0 }
+
+// Cells min_col up to (not including) max_col of one row, the unit brushes are
+// drawn in. Signed, a shape may hang over the edges of the grid and is
+// clipped when it is stamped.
+typedef struct
+{
+  i32 row;
+  i32 min_col;
+  i32 max_col;
+} pixel_span_t;
+
+// which neighbors a fill spreads to
+typedef enum {
+  PIXEL_FILL_COLOR,    // cells that look like the one clicked, empty ones included
+  PIXEL_FILL_MATERIAL, // cells of the same material, whatever their color
+} pixel_fill_mode_t;
+
+// how imported images are mapped to the palette of the frame
+typedef enum {
+  PIXEL_IMPORT_EXACT, // every color as it is, the nearest one once the palette is full
+  PIXEL_IMPORT_C64,   // the nearest of C64_COLORS, the palette is C64_COLORS
+} pixel_import_mode_t;
+
+// Nearest palette index of every color, 5 bits per channel of red, green and
+// blue (see pixel_lut_at). Built once per palette, a lookup is then one load
+// however many colors there are.
+#define PIXEL_LUT_BITS 5
+#define PIXEL_LUT_SIZE (1 << (3 * PIXEL_LUT_BITS))
+
+typedef struct
+{
+  u8 index[PIXEL_LUT_SIZE];
+} pixel_lut_t;
+
+// Growable list of spans, zeroed it is empty. Brushes are built in one and
+// stamped at once, a list that is cleared and reused does not allocate.
+typedef struct
+{
+  pixel_span_t* items;
+  u32 count;
+  u32 capacity;
+} pixel_spans_t;
+
+// GRID_CHUNK_SIZE square region of the grid. A chunk with nothing dirty is
+// asleep and the simulation skips it.
 typedef struct
 {
-  u32 col; // size in bytes (4)
-  u32 row; // size in bytes (4)
-  u8 size; // size in bytes (1)
-  pixel_type_t type; // size in bytes (4)
-  SDL_Color color; // size in bytes (4)
-} pixel_t; // total size in bytes (13)
+  pixel_rect_t dirty;      // cells the simulation visits in the current tick
+  pixel_rect_t dirty_next; // cells that changed, visited in the next tick
+  // set when a cell in or next to the chunk changed, cleared by whoever
+  // mirrors the frame elsewhere (the canvas texture, see dk_canvas.h)
+  u32 changed;
+} pixel_chunk_t;
 
 // pixel buffer
+//
+// A frame is two dense width * height byte grids, the position of a cell is
+// its index (row * width + col). Two bytes per cell, whatever the number of
+// particles, and how big the frame is drawn on screen is up to the renderer.
 typedef struct
 {
-  pixel_t* pixels;
+  // occupied cells
   u32 count;
+  // grid size in cells, every frame can have its own
+  u32 width;
+  u32 height;
+  // material ids, GRID_CELL_EMPTY or see pixel_type_to_material
+  u8* cells;
+  // index into `palette`, only meaningful for occupied cells
+  u8* colors;
+  SDL_Color palette[PIXEL_PALETTE_SIZE];
+  u32 palette_count;
+  u32 palette_last; // last color looked up, brushes paint one color at a time
+  // occupied cells per palette entry, an entry at 0 can take a new color
+  u32 palette_uses[PIXEL_PALETTE_SIZE];
+  pixel_chunk_t* chunks;
+  u32 chunk_cols;
+  u32 chunk_rows;
+  // ticks simulated since the frame was created or loaded, picks the random
+  // stream of the next tick so every frame replays the same way
+  u32 tick;
+  // cells and chunks the grids have room for, a frame that is loaded or
+  // resized within them does not allocate
+  u32 capacity;
+  u32 chunk_capacity;
+  // where the grids live, NULL for the heap
+  dk_memory_arena_t* arena;
+  // what pixel_buffer_add_circle and friends build their brush in, kept from
+  // call to call so stamping does not allocate
+  pixel_spans_t spans;
 } pixel_buffer_t;
 
 SDL_Color
 pixel_type_to_color(pixel_type_t type);
 
+u8
+pixel_type_to_material(pixel_type_t type);
+
+pixel_type_t
+pixel_material_to_type(u8 material);
+
 void
 pixel_buffer_merge(pixel_buffer_t* buffer, pixel_buffer_t* buffer2);
 
-void
+bool
 pixel_buffer_save_png(pixel_buffer_t* buffer, const char* filename, u32 scale);
 
+bool
+pixel_buffer_save_pngs(pixel_buffer_t* buffer, const char** filenames, const u32* scales, u32 count);
+
 void
 pixel_buffer_init(pixel_buffer_t* buffer);
 
 void
-pixel_buffer_add(pixel_buffer_t* buffer, pixel_t pixel);
+pixel_buffer_init_size(pixel_buffer_t* buffer, u32 width, u32 height);
 
 void
-pixel_buffer_clear(pixel_buffer_t* buffer);
+pixel_buffer_init_arena(pixel_buffer_t* buffer, dk_memory_arena_t* arena, u32 width, u32 height);
+
+void
+pixel_buffer_destroy(pixel_buffer_t* buffer);
 
 void
-pixel_buffer_remove(pixel_buffer_t* buffer, u32 index);
+pixel_buffer_resize(pixel_buffer_t* buffer, u32 width, u32 height);
+
+void
+pixel_buffer_copy(pixel_buffer_t* copy, pixel_buffer_t* buffer);
+
+void
+pixel_buffer_add(pixel_buffer_t* buffer, pixel_t pixel);
+
+void
+pixel_buffer_clear(pixel_buffer_t* buffer);
 
 void
 pixel_buffer_remove_all(pixel_buffer_t* buffer, u32 col, u32 row);
@@ -60,15 +184,22 @@ pixel_buffer_remove_all(pixel_buffer_t* buffer, u32 col, u32 row);
 void
 pixel_buffer_draw(pixel_buffer_t* buffer, app_camera_t* camera, SDL_Renderer* renderer);
 
-void
-png_to_pixel_buffer(pixel_buffer_t* buffer, const char* filename, int scale);
+bool
+png_to_pixel_buffer(pixel_buffer_t* buffer, const char* filename, int scale, pixel_import_mode_t mode);
+
+bool
+pixel_buffer_import_surface(pixel_buffer_t* buffer, SDL_Surface* surface, int scale, pixel_import_mode_t mode);
 
 void
+pixel_lut_build(pixel_lut_t* lut, const SDL_Color* palette, u32 count);
+
+bool
 pixel_buffer_save(pixel_buffer_t* buffer, const char* filename);
 
-void
+bool
 pixel_buffer_load(pixel_buffer_t* buffer, const char* filename);
 
+// implemented by the simulation engine, see dk_simulation.h
 void
 update_pixel_simulation(pixel_buffer_t* buffer);
 
@@ -84,563 +215,1616 @@ pixel_buffer_add_rect(pixel_buffer_t* buffer, pixel_t pixel, u32 width, u32 heig
 void
 pixel_buffer_add_rect_outline(pixel_buffer_t* buffer, pixel_t pixel, u32 width, u32 height, bool erase);
 
+void
+pixel_buffer_stamp(pixel_buffer_t* buffer, pixel_span_t* spans, u32 count, pixel_t pixel, bool erase);
+
+void
+pixel_buffer_fill(pixel_buffer_t* buffer, pixel_t pixel, pixel_fill_mode_t mode, bool erase);
+
+void
+pixel_spans_push(pixel_spans_t* spans, pixel_span_t span);
+
+void
+pixel_spans_circle(pixel_spans_t* spans, i32 col, i32 row, u32 radius);
+
+void
+pixel_spans_line(pixel_spans_t* spans, i32 col, i32 row, u32 length, u32 direction);
+
+void
+pixel_spans_rect(pixel_spans_t* spans, i32 col, i32 row, u32 width, u32 height);
+
+void
+pixel_spans_rect_outline(pixel_spans_t* spans, i32 col, i32 row, u32 width, u32 height);
+
+void
+pixel_spans_coalesce(pixel_spans_t* spans);
+
+void
+pixel_spans_free(pixel_spans_t* spans);
+
 pixel_t
 pixel_buffer_get_pixel(pixel_buffer_t* buffer, u32 col, u32 row);
 
 void
 pixel_buffer_set_pixel(pixel_buffer_t* buffer, pixel_t pixel);
 
-pixel_t*
-pixel_buffer_get(pixel_buffer_t* buffer, u32 col, u32 row);
+bool
+pixel_buffer_is_empty(pixel_buffer_t* buffer, u32 col, u32 row);
+
+void
+pixel_buffer_shade_pixel(pixel_buffer_t* buffer, u32 col, u32 row, u32 radius);
+
+SDL_Color
+pixel_buffer_cell_color(pixel_buffer_t* buffer, u32 cell);
+
+void
+pixel_buffer_swap_cells(pixel_buffer_t* buffer, u32 a, u32 b);
+
+void
+pixel_buffer_wake(pixel_buffer_t* buffer, u32 col, u32 row);
+
+void
+pixel_buffer_wake_rect(pixel_buffer_t* buffer, pixel_rect_t rect);
 
 void
-pixel_buffer_shade_pixel(pixel_buffer_t* buffer, pixel_t* pixel, u32 radius);
+pixel_buffer_wake_all(pixel_buffer_t* buffer);
 
-pixel_t*
-pixel_buffer_get_pixel_ptr(pixel_buffer_t* buffer, u32 col, u32 row);
+pixel_chunk_t*
+pixel_buffer_chunk(pixel_buffer_t* buffer, u32 chunk_col, u32 chunk_row);
+
+bool
+pixel_rect_is_empty(pixel_rect_t rect);
 
 
 #if defined(DK_PIXELBUFFER_IMPLEMENTATION)
 
-void
-pixel_buffer_init(pixel_buffer_t* buffer)
+bool
+pixel_rect_is_empty(pixel_rect_t rect)
 {
-  buffer->pixels = NULL;
-  buffer->count = 0;
+  return rect.min_col >= rect.max_col || rect.min_row >= rect.max_row;
 }
 
-void
-pixel_buffer_merge(pixel_buffer_t* buffer, pixel_buffer_t* buffer2)
+// atomic, simulation threads can grow the rect of a chunk they share a border
+// with at the same time
+internal void
+pixel_rect__union(pixel_rect_t* rect, u32 min_col, u32 min_row, u32 max_col, u32 max_row)
+{
+  dk_atomic_min_u32(&rect->min_col, min_col);
+  dk_atomic_min_u32(&rect->min_row, min_row);
+  dk_atomic_max_u32(&rect->max_col, max_col);
+  dk_atomic_max_u32(&rect->max_row, max_row);
+}
+
+internal void*
+pixel_buffer__alloc(pixel_buffer_t* buffer, sz_t size)
 {
-  for (u32 i = 0; i < buffer2->count; i++) {
-    pixel_buffer_add(buffer, buffer2->pixels[i]);
+  if (buffer->arena != NULL) {
+    return dk_memory_arena_alloc(buffer->arena, size);
   }
+  return malloc(size);
 }
 
-void
-pixel_buffer_add(pixel_buffer_t* buffer, pixel_t pixel)
+// Storage for the current size. cells and colors share one block, it grows
+// at least twice as big so a run of bigger and bigger loads settles after a
+// few allocations, and a heap block is given back once the frame needs less
+// than a quarter of it. Arena blocks belong to the arena and are never freed
+// here, the arena hands them back when it is reset.
+internal void
+pixel_buffer__reserve(pixel_buffer_t* buffer)
 {
+  u32 cell_count = buffer->width * buffer->height;
+  bool shrink = buffer->arena == NULL && cell_count < buffer->capacity / 4;
+  if (buffer->cells == NULL || cell_count > buffer->capacity || shrink) {
+    u32 capacity = cell_count;
+    if (!shrink) {
+      capacity = MIN(MAX(cell_count, buffer->capacity * 2), GRID_MAX_WIDTH * GRID_MAX_HEIGHT);
+    }
 
-  assert(buffer != NULL);
-  if (pixel.col >= GRID_WIDTH || pixel.row >= GRID_HEIGHT) {
-    return;
+    if (buffer->arena == NULL) {
+      free(buffer->cells);
+    }
+    buffer->cells = (u8*)pixel_buffer__alloc(buffer, sizeof(u8) * 2 * capacity);
+    buffer->colors = buffer->cells + capacity;
+    buffer->capacity = capacity;
   }
 
-  // if pixel already exists, swap it with the last pixel in the buffer
-  for (u32 i = 0; i < buffer->count; i++) {
-    if (buffer->pixels[i].col == pixel.col && buffer->pixels[i].row == pixel.row) {
-      buffer->pixels[i] = buffer->pixels[buffer->count - 1];
-      buffer->count--;
-      break;
+  u32 chunk_count = buffer->chunk_cols * buffer->chunk_rows;
+  bool shrink_chunks = buffer->arena == NULL && chunk_count < buffer->chunk_capacity / 4;
+  if (buffer->chunks == NULL || chunk_count > buffer->chunk_capacity || shrink_chunks) {
+    u32 capacity = chunk_count;
+    if (!shrink_chunks) {
+      u32 max_chunks = ((GRID_MAX_WIDTH + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE) *
+                       ((GRID_MAX_HEIGHT + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE);
+      capacity = MIN(MAX(chunk_count, buffer->chunk_capacity * 2), max_chunks);
     }
-  }
 
-  buffer->pixels = realloc(buffer->pixels, sizeof(pixel_t) * (buffer->count + 1));
-  buffer->pixels[buffer->count] = pixel;
-  buffer->count++;
+    if (buffer->arena == NULL) {
+      free(buffer->chunks);
+    }
+    buffer->chunks = (pixel_chunk_t*)pixel_buffer__alloc(buffer, sizeof(pixel_chunk_t) * capacity);
+    buffer->chunk_capacity = capacity;
+  }
 }
 
-void
-pixel_buffer_add_circle(pixel_buffer_t* buffer, pixel_t pixel, u32 radius, bool erase)
+internal void
+pixel_buffer__release(pixel_buffer_t* buffer)
 {
-  for (u32 i = 0; i < radius; i++) {
-    for (u32 j = 0; j < radius; j++) {
-      if (i * i + j * j <= radius * radius) {
-        pixel_t p = pixel;
-        p.col += i;
-        p.row += j;
-        if (erase) {
-          pixel_buffer_remove_all(buffer, p.col, p.row);
-        } else {
-          pixel_buffer_add(buffer, p);
-        }
-
-        p = pixel;
-        p.col -= i;
-        p.row += j;
-        if (erase) {
-          pixel_buffer_remove_all(buffer, p.col, p.row);
-        } else {
-          pixel_buffer_add(buffer, p);
-        }
-
-        p = pixel;
-        p.col += i;
-        p.row -= j;
-        if (erase) {
-          pixel_buffer_remove_all(buffer, p.col, p.row);
-        } else {
-          pixel_buffer_add(buffer, p);
-        }
-
-        p = pixel;
-        p.col -= i;
-        p.row -= j;
-        if (erase) {
-          pixel_buffer_remove_all(buffer, p.col, p.row);
-        } else {
-          pixel_buffer_add(buffer, p);
-        }
-      }
-    }
+  if (buffer->arena == NULL) {
+    free(buffer->cells);
+    free(buffer->chunks);
   }
+  buffer->cells = NULL;
+  buffer->colors = NULL;
+  buffer->chunks = NULL;
+  buffer->capacity = 0;
+  buffer->chunk_capacity = 0;
+  buffer->count = 0;
 }
 
-void
-pixel_buffer_add_line(pixel_buffer_t* buffer, pixel_t pixel, u32 length, u32 direction, bool erase)
+// Empty grids of width * height cells, every chunk asleep. The storage is
+// reused when it is big enough, see pixel_buffer__reserve.
+internal void
+pixel_buffer__set_size(pixel_buffer_t* buffer, u32 width, u32 height)
 {
-  for (u32 i = 0; i < length; i++) {
-    pixel_t p = pixel;
-    switch (direction) {
-      case 0: p.col += i; break;
-      case 1: p.row += i; break;
-      case 2: p.col -= i; break;
-      case 3: p.row -= i; break;
-    }
-    if (erase) {
-      pixel_buffer_remove_all(buffer, p.col, p.row);
-    } else {
-      pixel_buffer_add(buffer, p);
-    }
+  buffer->count = 0;
+  buffer->width = CLAMP(width, 1, GRID_MAX_WIDTH);
+  buffer->height = CLAMP(height, 1, GRID_MAX_HEIGHT);
+  buffer->chunk_cols = (buffer->width + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+  buffer->chunk_rows = (buffer->height + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+  pixel_buffer__reserve(buffer);
+
+  memset(buffer->cells, GRID_CELL_EMPTY, sizeof(u8) * buffer->width * buffer->height);
+  memset(buffer->colors, 0, sizeof(u8) * buffer->width * buffer->height);
+  memset(buffer->palette_uses, 0, sizeof(buffer->palette_uses));
+  for (u32 i = 0; i < buffer->chunk_cols * buffer->chunk_rows; i++) {
+    buffer->chunks[i].dirty = PIXEL_RECT_EMPTY;
+    buffer->chunks[i].dirty_next = PIXEL_RECT_EMPTY;
+    buffer->chunks[i].changed = 1;
   }
 }
 
-void
-pixel_buffer_add_rect(pixel_buffer_t* buffer, pixel_t pixel, u32 width, u32 height, bool erase)
+internal u8*
+pixel_buffer__cells(pixel_buffer_t* buffer)
 {
-  for (u32 i = 0; i < width; i++) {
-    for (u32 j = 0; j < height; j++) {
-      pixel_t p = pixel;
-      p.col += i - width / 2;
-      p.row += j - height / 2;
-      if (erase) {
-        pixel_buffer_remove_all(buffer, p.col, p.row);
-      } else {
-        pixel_buffer_add(buffer, p);
-      }
+  if (buffer->cells == NULL) {
+    if (buffer->width == 0 || buffer->height == 0) {
+      buffer->width = GRID_WIDTH;
+      buffer->height = GRID_HEIGHT;
     }
+    pixel_buffer__set_size(buffer, buffer->width, buffer->height);
   }
+  return buffer->cells;
 }
 
-void
-pixel_buffer_add_rect_outline(pixel_buffer_t* buffer, pixel_t pixel, u32 width, u32 height, bool erase)
+internal u32
+pixel__pack_color(SDL_Color color)
 {
-  for (u32 i = 0; i <= width; i++) {
-    pixel_t p = pixel;
-    p.col += i - width / 2;
-    p.row -= height / 2;
-    if (erase) {
-      pixel_buffer_remove_all(buffer, p.col, p.row);
-    } else {
-      pixel_buffer_add(buffer, p);
-    }
+  return (u32)color.r << 24 | (u32)color.g << 16 | (u32)color.b << 8 | color.a;
+}
 
-    p = pixel;
-    p.col += i - width / 2;
-    p.row += height / 2;
-    if (erase) {
-      pixel_buffer_remove_all(buffer, p.col, p.row);
-    } else {
-      pixel_buffer_add(buffer, p);
+// Palette slot of a color, added when it is new. A full palette gives the
+// color an entry no occupied cell uses anymore, so painting, shading and
+// imports over a long session do not run out of slots, and only hands out
+// the closest color it has when every entry is in use.
+internal u8
+pixel_buffer__color_index(pixel_buffer_t* buffer, SDL_Color color)
+{
+  u32 packed = pixel__pack_color(color);
+  if (buffer->palette_count > 0 && pixel__pack_color(buffer->palette[buffer->palette_last]) == packed) {
+    return (u8)buffer->palette_last;
+  }
+
+  for (u32 i = 0; i < buffer->palette_count; i++) {
+    if (pixel__pack_color(buffer->palette[i]) == packed) {
+      buffer->palette_last = i;
+      return (u8)i;
     }
   }
 
-  for (u32 i = 0; i < height; i++) {
-    pixel_t p = pixel;
-    p.col -= width / 2;
-    p.row += i - height / 2;
-    if (erase) {
-      pixel_buffer_remove_all(buffer, p.col, p.row);
-    } else {
-      pixel_buffer_add(buffer, p);
+  if (buffer->palette_count < PIXEL_PALETTE_SIZE) {
+    buffer->palette[buffer->palette_count] = color;
+    buffer->palette_last = buffer->palette_count++;
+    return (u8)buffer->palette_last;
+  }
+
+  for (u32 i = 0; i < buffer->palette_count; i++) {
+    if (buffer->palette_uses[i] == 0) {
+      buffer->palette[i] = color;
+      buffer->palette_last = i;
+      return (u8)i;
     }
+  }
 
-    p = pixel;
-    p.col += width / 2;
-    p.row += i - height / 2;
-    if (erase) {
-      pixel_buffer_remove_all(buffer, p.col, p.row);
-    } else {
-      pixel_buffer_add(buffer, p);
+  u32 nearest = 0;
+  i32 nearest_distance = INT32_MAX;
+  for (u32 i = 0; i < buffer->palette_count; i++) {
+    SDL_Color other = buffer->palette[i];
+    i32 dr = (i32)other.r - color.r;
+    i32 dg = (i32)other.g - color.g;
+    i32 db = (i32)other.b - color.b;
+    i32 da = (i32)other.a - color.a;
+    i32 distance = dr * dr + dg * dg + db * db + da * da;
+    if (distance < nearest_distance) {
+      nearest = i;
+      nearest_distance = distance;
     }
   }
+  return (u8)nearest;
 }
 
-void
-pixel_buffer_clear(pixel_buffer_t* buffer)
+pixel_chunk_t*
+pixel_buffer_chunk(pixel_buffer_t* buffer, u32 chunk_col, u32 chunk_row)
 {
-  free(buffer->pixels);
-  buffer->pixels = NULL;
-  buffer->count = 0;
+  return &buffer->chunks[chunk_row * buffer->chunk_cols + chunk_col];
 }
 
+// Marks the cell and its eight neighbors dirty, both for the tick in progress
+// (if any) and for the next one. Every simulation rule only looks one cell
+// away, so anything a change can set in motion is inside that block.
 void
-pixel_buffer_remove(pixel_buffer_t* buffer, u32 index)
+pixel_buffer_wake(pixel_buffer_t* buffer, u32 col, u32 row)
 {
-  if (index < buffer->count) {
-    buffer->pixels[index] = buffer->pixels[buffer->count - 1];
-    buffer->count--;
-    buffer->pixels = realloc(buffer->pixels, sizeof(pixel_t) * buffer->count);
-  }
+  pixel_buffer_wake_rect(buffer, (pixel_rect_t){ col, row, col + 1, row + 1 });
 }
 
+// pixel_buffer_wake for every cell of `rect` at once, one union per chunk
 void
-pixel_buffer_remove_all(pixel_buffer_t* buffer, u32 col, u32 row)
+pixel_buffer_wake_rect(pixel_buffer_t* buffer, pixel_rect_t rect)
 {
-  if (buffer->count == 0) {
+  if (pixel_rect_is_empty(rect)) {
     return;
   }
 
-  for (u32 i = 0; i < buffer->count; i++) {
-    if (buffer->pixels[i].col == col && buffer->pixels[i].row == row) {
-      pixel_buffer_remove(buffer, i);
-      i--;
+  u32 min_col = rect.min_col > 0 ? rect.min_col - 1 : 0;
+  u32 min_row = rect.min_row > 0 ? rect.min_row - 1 : 0;
+  u32 max_col = MIN(rect.max_col + 1, buffer->width);
+  u32 max_row = MIN(rect.max_row + 1, buffer->height);
+
+  for (u32 chunk_row = min_row / GRID_CHUNK_SIZE; chunk_row <= (max_row - 1) / GRID_CHUNK_SIZE; chunk_row++) {
+    for (u32 chunk_col = min_col / GRID_CHUNK_SIZE; chunk_col <= (max_col - 1) / GRID_CHUNK_SIZE; chunk_col++) {
+      pixel_chunk_t* chunk = pixel_buffer_chunk(buffer, chunk_col, chunk_row);
+
+      u32 rect_min_col = MAX(min_col, chunk_col * GRID_CHUNK_SIZE);
+      u32 rect_min_row = MAX(min_row, chunk_row * GRID_CHUNK_SIZE);
+      u32 rect_max_col = MIN(max_col, (chunk_col + 1) * GRID_CHUNK_SIZE);
+      u32 rect_max_row = MIN(max_row, (chunk_row + 1) * GRID_CHUNK_SIZE);
+
+      pixel_rect__union(&chunk->dirty, rect_min_col, rect_min_row, rect_max_col, rect_max_row);
+      pixel_rect__union(&chunk->dirty_next, rect_min_col, rect_min_row, rect_max_col, rect_max_row);
+      dk_atomic_store_u32(&chunk->changed, 1);
     }
   }
 }
 
-pixel_t*
-pixel_buffer_get(pixel_buffer_t* buffer, u32 col, u32 row)
+void
+pixel_buffer_wake_all(pixel_buffer_t* buffer)
 {
-  for (u32 i = 0; i < buffer->count; i++) {
-    if (buffer->pixels[i].col == col && buffer->pixels[i].row == row) {
-      return &buffer->pixels[i];
+  pixel_buffer__cells(buffer);
+  for (u32 chunk_row = 0; chunk_row < buffer->chunk_rows; chunk_row++) {
+    for (u32 chunk_col = 0; chunk_col < buffer->chunk_cols; chunk_col++) {
+      pixel_chunk_t* chunk = pixel_buffer_chunk(buffer, chunk_col, chunk_row);
+      chunk->dirty_next = (pixel_rect_t){
+        .min_col = chunk_col * GRID_CHUNK_SIZE,
+        .min_row = chunk_row * GRID_CHUNK_SIZE,
+        .max_col = MIN((chunk_col + 1) * GRID_CHUNK_SIZE, buffer->width),
+        .max_row = MIN((chunk_row + 1) * GRID_CHUNK_SIZE, buffer->height),
+      };
+      chunk->dirty = chunk->dirty_next;
+      chunk->changed = 1;
     }
   }
+}
 
-  pixel_t *pixel = (pixel_t*)malloc(sizeof(pixel_t));
-  *pixel = (pixel_t){
-    .col = col,
-    .row = row,
-    .color = { .r = 0, .g = 0, .b = 0, .a = 0 },
-    .type = 0,
-    .size = 1,
-  };
+void
+pixel_buffer_init(pixel_buffer_t* buffer)
+{
+  pixel_buffer_init_size(buffer, GRID_WIDTH, GRID_HEIGHT);
 }
 
 void
-pixel_buffer_draw(pixel_buffer_t* buffer, app_camera_t* camera, SDL_Renderer* renderer)
+pixel_buffer_init_size(pixel_buffer_t* buffer, u32 width, u32 height)
 {
-  for (u32 i = 0; i < buffer->count; i++) {
-    SDL_Rect rect = {
-      .x = buffer->pixels[i].col * buffer->pixels[i].size,
-      .y = buffer->pixels[i].row * buffer->pixels[i].size,
-      .w = buffer->pixels[i].size,
-      .h = buffer->pixels[i].size,
-    };
+  pixel_buffer_init_arena(buffer, NULL, width, height);
+}
 
-    rect.x += (WINDOW_WIDTH - GRID_WIDTH * buffer->pixels[i].size) / 2;
-    rect.y += (WINDOW_HEIGHT - GRID_HEIGHT * buffer->pixels[i].size) / 2;
+// Grids allocated from `arena` instead of the heap, for frames that live as
+// long as the arena. pixel_buffer_destroy leaves them to the arena.
+void
+pixel_buffer_init_arena(pixel_buffer_t* buffer, dk_memory_arena_t* arena, u32 width, u32 height)
+{
+  buffer->cells = NULL;
+  buffer->colors = NULL;
+  buffer->chunks = NULL;
+  buffer->capacity = 0;
+  buffer->chunk_capacity = 0;
+  buffer->arena = arena;
+  buffer->spans = (pixel_spans_t){ 0 };
+  buffer->palette_count = 0;
+  buffer->palette_last = 0;
+  buffer->tick = 0;
+  pixel_buffer__set_size(buffer, width, height);
+}
+
+void
+pixel_buffer_destroy(pixel_buffer_t* buffer)
+{
+  pixel_buffer__release(buffer);
+  pixel_spans_free(&buffer->spans);
+}
 
-    rect.x += camera->x;
-    rect.y += camera->y;
+// Changes the grid size, the top left corner is kept and cells that no longer
+// fit are dropped.
+void
+pixel_buffer_resize(pixel_buffer_t* buffer, u32 width, u32 height)
+{
+  if (buffer->cells != NULL && buffer->width == width && buffer->height == height) {
+    return;
+  }
 
-    SDL_Color color = buffer->pixels[i].color;
+  // nothing to keep, the storage can be reused
+  if (buffer->count == 0) {
+    pixel_buffer__set_size(buffer, width, height);
+    pixel_buffer_wake_all(buffer);
+    return;
+  }
 
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-    SDL_RenderFillRect(renderer, &rect);
+  pixel_buffer_t old = *buffer;
+  buffer->cells = NULL;
+  buffer->colors = NULL;
+  buffer->chunks = NULL;
+  buffer->capacity = 0;
+  buffer->chunk_capacity = 0;
+  pixel_buffer__set_size(buffer, width, height);
+
+  u32 copy_width = MIN(old.width, buffer->width);
+  u32 copy_height = MIN(old.height, buffer->height);
+  for (u32 row = 0; row < copy_height; row++) {
+    memcpy(buffer->cells + row * buffer->width, old.cells + row * old.width, copy_width);
+    memcpy(buffer->colors + row * buffer->width, old.colors + row * old.width, copy_width);
+    for (u32 col = 0; col < copy_width; col++) {
+      u32 cell = row * buffer->width + col;
+      if (buffer->cells[cell] != GRID_CELL_EMPTY) {
+        buffer->count++;
+        buffer->palette_uses[buffer->colors[cell]]++;
+      }
+    }
   }
+
+  pixel_buffer__release(&old);
+  pixel_buffer_wake_all(buffer);
 }
 
+// Makes `copy` (an initialized frame) hold the same cells, palette and tick as
+// `buffer`: two memcpys, cheap enough to take on the main thread and hand to
+// a worker that saves it while the frame keeps changing. The chunks of the
+// copy start asleep.
 void
-pixel_buffer_shade_pixel(pixel_buffer_t* buffer, pixel_t* pixel, u32 radius)
+pixel_buffer_copy(pixel_buffer_t* copy, pixel_buffer_t* buffer)
 {
-  SDL_Color *color = &pixel->color;
-  if (pixel_buffer_get(buffer, pixel->col - radius, pixel->row)->color.a == 0 ||
-      pixel_buffer_get(buffer, pixel->col + radius, pixel->row)->color.a == 0 ||
-      pixel_buffer_get(buffer, pixel->col, pixel->row - radius)->color.a == 0 ||
-      pixel_buffer_get(buffer, pixel->col, pixel->row + radius)->color.a == 0) {
-    color->r /= 1.5;
-    color->g /= 1.5;
-    color->b /= 1.5;
+  pixel_buffer__set_size(copy, buffer->width, buffer->height);
+  if (buffer->cells != NULL) {
+    memcpy(copy->cells, buffer->cells, sizeof(u8) * buffer->width * buffer->height);
+    memcpy(copy->colors, buffer->colors, sizeof(u8) * buffer->width * buffer->height);
+    memcpy(copy->palette_uses, buffer->palette_uses, sizeof(buffer->palette_uses));
+    copy->count = buffer->count;
   }
+  memcpy(copy->palette, buffer->palette, sizeof(SDL_Color) * buffer->palette_count);
+  copy->palette_count = buffer->palette_count;
+  copy->palette_last = 0;
+  copy->tick = buffer->tick;
 }
 
+// Exchanges the contents of two cells, either of which may be empty. This is
+// how the simulation moves particles around.
 void
-pixel_buffer_save_png(pixel_buffer_t* buffer, const char* filename, u32 scale)
+pixel_buffer_swap_cells(pixel_buffer_t* buffer, u32 a, u32 b)
 {
+  u8 material = buffer->cells[a];
+  buffer->cells[a] = buffer->cells[b];
+  buffer->cells[b] = material;
 
-  SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, GRID_WIDTH * scale, GRID_HEIGHT * scale, 32, SDL_PIXELFORMAT_RGBA32);
-
-  for (u32 i = 0; i < buffer->count; i++) {
-    pixel_t pixel = buffer->pixels[i];
-    SDL_Rect rect;
+  u8 color = buffer->colors[a];
+  buffer->colors[a] = buffer->colors[b];
+  buffer->colors[b] = color;
 
-    rect.x = pixel.col * scale;
-    rect.y = pixel.row * scale;
+  pixel_buffer_wake(buffer, a % buffer->width, a / buffer->width);
+  pixel_buffer_wake(buffer, b % buffer->width, b / buffer->width);
+}
 
-    rect.w = scale;
-    rect.h = scale;
+SDL_Color
+pixel_buffer_cell_color(pixel_buffer_t* buffer, u32 cell)
+{
+  return buffer->palette[buffer->colors[cell]];
+}
 
-    SDL_Color color = pixel.color;
-    SDL_FillRect(surface, &rect, SDL_MapRGBA(surface->format, color.r, color.g, color.b, color.a));
+// copies every occupied cell of buffer2 over buffer, at the same position
+void
+pixel_buffer_merge(pixel_buffer_t* buffer, pixel_buffer_t* buffer2)
+{
+  if (buffer2->cells == NULL) {
+    return;
   }
 
-  IMG_SavePNG(surface, filename);
-  SDL_FreeSurface(surface);
+  for (u32 row = 0; row < buffer2->height; row++) {
+    for (u32 col = 0; col < buffer2->width; col++) {
+      if (buffer2->cells[row * buffer2->width + col] != GRID_CELL_EMPTY) {
+        pixel_buffer_add(buffer, pixel_buffer_get_pixel(buffer2, col, row));
+      }
+    }
+  }
 }
 
-pixel_t
-pixel_buffer_get_pixel(pixel_buffer_t* buffer, u32 col, u32 row)
+// pixel_buffer_add without waking the neighborhood, for bulk writes that
+// wake the whole frame once at the end
+internal bool
+pixel_buffer__put(pixel_buffer_t* buffer, pixel_t pixel)
 {
-  for (u32 i = 0; i < buffer->count; i++) {
-    if (buffer->pixels[i].col == col && buffer->pixels[i].row == row) {
-      return buffer->pixels[i];
-    }
+  if (pixel.col >= buffer->width || pixel.row >= buffer->height) {
+    return false;
   }
 
-  pixel_t pixel = { 0 };
-  return pixel;
-}
+  u8* cells = pixel_buffer__cells(buffer);
+  u32 cell = pixel.row * buffer->width + pixel.col;
+  // before the cell changes, its old color still counts as used
+  u8 color = pixel_buffer__color_index(buffer, pixel.color);
 
-pixel_t*
-pixel_buffer_get_pixel_ptr(pixel_buffer_t* buffer, u32 col, u32 row)
-{
-  for (u32 i = 0; i < buffer->count; i++) {
-    if (buffer->pixels[i].col == col && buffer->pixels[i].row == row) {
-      return &buffer->pixels[i];
-    }
+  // an occupied cell is replaced
+  if (cells[cell] == GRID_CELL_EMPTY) {
+    buffer->count++;
+  } else {
+    buffer->palette_uses[buffer->colors[cell]]--;
   }
 
-  return NULL;
+  cells[cell] = pixel_type_to_material(pixel.type);
+  buffer->colors[cell] = color;
+  buffer->palette_uses[color]++;
+  return true;
 }
 
 void
-pixel_buffer_set_pixel(pixel_buffer_t* buffer, pixel_t pixel)
+pixel_buffer_add(pixel_buffer_t* buffer, pixel_t pixel)
 {
-  for (u32 i = 0; i < buffer->count; i++) {
-    if (buffer->pixels[i].col == pixel.col && buffer->pixels[i].row == pixel.row) {
-      buffer->pixels[i] = pixel;
-    }
-  }
 
-  pixel_buffer_add(buffer, pixel);
+  assert(buffer != NULL);
+  if (pixel_buffer__put(buffer, pixel)) {
+    pixel_buffer_wake(buffer, pixel.col, pixel.row);
+  }
 }
 
-Uint32
-get_pixel(SDL_Surface* surface, u32 x, u32 y)
+// Writes (or erases) the part of a span that is on the grid with two memsets
+// and wakes its neighborhood once. Erasing cells that are already empty
+// changes nothing and wakes nothing, like pixel_buffer_remove_all.
+internal void
+pixel_buffer__span(pixel_buffer_t* buffer, pixel_span_t span, u8 material, u8 color, bool erase, u32 (*replaced)[PIXEL_PALETTE_SIZE])
 {
-  u32 bytes_per_pixel = surface->format->BytesPerPixel;
-  u8* pixel = (u8*)surface->pixels + y * surface->pitch + x * bytes_per_pixel;
+  if (span.row < 0 || (u32)span.row >= buffer->height || span.max_col <= 0 ||
+      span.min_col >= (i32)buffer->width || span.min_col >= span.max_col) {
+    return;
+  }
+  if (erase && buffer->cells == NULL) {
+    return;
+  }
 
-  switch (bytes_per_pixel) {
-    case 1:
-      return *pixel;
-    case 2:
-      return *(u16*)pixel;
-    case 3:
-      if (SDL_BYTEORDER == SDL_BIG_ENDIAN) {
-        return pixel[0] << 16 | pixel[1] << 8 | pixel[2];
-      } else {
-        return pixel[0] | pixel[1] << 8 | pixel[2] << 16;
-      }
-    case 4:
-      return *(u32*)pixel;
-    default:
-      return 0;
+  u32 min_col = (u32)MAX(span.min_col, 0);
+  u32 max_col = MIN((u32)span.max_col, buffer->width);
+  u32 length = max_col - min_col;
+  u32 first = (u32)span.row * buffer->width + min_col;
+  u8* cells = pixel_buffer__cells(buffer) + first;
+  u8* colors = buffer->colors + first;
+
+  // every occupied cell of the span is erased or painted over
+  u32 occupied = 0;
+  for (u32 i = 0; i < length; i++) {
+    occupied += cells[i] != GRID_CELL_EMPTY;
+  }
+  for (u32 i = 0; occupied != 0 && i < length; i++) {
+    replaced[i & 3][colors[i]] += cells[i] != GRID_CELL_EMPTY;
   }
 
-  return 0;
+  if (erase) {
+    if (occupied == 0) {
+      return;
+    }
+    // only wakes around the cells that were occupied
+    while (cells[length - 1] == GRID_CELL_EMPTY) {
+      length--;
+    }
+    while (cells[0] == GRID_CELL_EMPTY) {
+      cells++;
+      length--;
+      min_col++;
+    }
+    memset(cells, GRID_CELL_EMPTY, length);
+    buffer->count -= occupied;
+    max_col = min_col + length;
+  } else {
+    memset(cells, material, length);
+    memset(colors, color, length);
+    buffer->palette_uses[color] += length;
+    buffer->count += length - occupied;
+  }
+
+  pixel_buffer_wake_rect(buffer, (pixel_rect_t){ min_col, (u32)span.row, max_col, (u32)span.row + 1 });
 }
 
+// Paints (or erases) every span with the type and color of `pixel`, its
+// position is not used. Spans may overlap or fall off the grid, the material
+// and palette index are looked up once for all of them.
 void
-png_to_pixel_buffer(pixel_buffer_t* buffer, const char* filename, int scale)
+pixel_buffer_stamp(pixel_buffer_t* buffer, pixel_span_t* spans, u32 count, pixel_t pixel, bool erase)
 {
-  pixel_buffer_clear(buffer);
-
-  SDL_Surface* surface = IMG_Load(filename);
-  if (surface != NULL) {
-    pixel_buffer_clear(buffer);
+  u8 material = GRID_CELL_EMPTY;
+  u8 color = 0;
+  if (!erase) {
+    material = pixel_type_to_material(pixel.type);
+    color = pixel_buffer__color_index(buffer, pixel.color);
+  }
 
-    for (u32 y = 0; y < surface->h; y += scale) {
-      for (u32 x = 0; x < surface->w; x += scale) {
+  // colors of the cells the spans erase or paint over, four tallies so that
+  // runs of one color do not wait on the same counter
+  u32 replaced[4][PIXEL_PALETTE_SIZE];
+  memset(replaced, 0, sizeof(replaced));
+  for (u32 i = 0; i < count; i++) {
+    pixel_buffer__span(buffer, spans[i], material, color, erase, replaced);
+  }
+  for (u32 i = 0; i < PIXEL_PALETTE_SIZE; i++) {
+    buffer->palette_uses[i] -= replaced[0][i] + replaced[1][i] + replaced[2][i] + replaced[3][i];
+  }
+}
 
-        Uint32 pixel = get_pixel(surface, x, y);
-        SDL_Color color;
-        SDL_GetRGBA(pixel, surface->format, &color.r, &color.g, &color.b, &color.a);
+void
+pixel_spans_push(pixel_spans_t* spans, pixel_span_t span)
+{
+  if (span.min_col >= span.max_col) {
+    return;
+  }
+  if (spans->count == spans->capacity) {
+    spans->capacity = MAX(64, spans->capacity * 2);
+    spans->items = (pixel_span_t*)realloc(spans->items, sizeof(pixel_span_t) * spans->capacity);
+  }
+  spans->items[spans->count++] = span;
+}
 
-        pixel_t p;
-        p.col = x / scale;
-        p.row = y / scale;
-        p.color = color;
+void
+pixel_spans_free(pixel_spans_t* spans)
+{
+  free(spans->items);
+  *spans = (pixel_spans_t){ 0 };
+}
 
-        pixel_buffer_add(buffer, p);
-      }
+// Cells less than `radius` away from the center on both axes and within
+// `radius` of it, one span per row.
+void
+pixel_spans_circle(pixel_spans_t* spans, i32 col, i32 row, u32 radius)
+{
+  i32 r = (i32)radius;
+  // integer square root of r * r - y * y, it moves a few steps between rows
+  i32 root = 0;
+  for (i32 y = 1 - r; y < r; y++) {
+    i32 rest = r * r - y * y;
+    while ((root + 1) * (root + 1) <= rest) {
+      root++;
     }
-
-    SDL_FreeSurface(surface);
+    while (root * root > rest) {
+      root--;
+    }
+    i32 half = MIN(root, r - 1);
+    pixel_spans_push(spans, (pixel_span_t){ row + y, col - half, col + half + 1 });
   }
 }
 
+// `length` cells from (col, row) to the right, down, left or up (direction 0
+// to 3)
 void
-pixel_buffer_save(pixel_buffer_t* buffer, const char* filename)
+pixel_spans_line(pixel_spans_t* spans, i32 col, i32 row, u32 length, u32 direction)
 {
-  //
-  // TODO (David): We need to add a version number to the file format and format signature
-  //
-  FILE* file = fopen(filename, "wb");
-  if (file != NULL) {
-    (void)fwrite(&buffer->count, sizeof(u32), 1, file);
-    (void)fwrite(buffer->pixels, sizeof(pixel_t), buffer->count, file);
-    fclose(file);
+  i32 n = (i32)length;
+  switch (direction) {
+    case 0: pixel_spans_push(spans, (pixel_span_t){ row, col, col + n }); break;
+    case 2: pixel_spans_push(spans, (pixel_span_t){ row, col - n + 1, col + 1 }); break;
+    case 1:
+    case 3:
+      for (i32 i = 0; i < n; i++) {
+        i32 y = direction == 1 ? row + i : row - i;
+        pixel_spans_push(spans, (pixel_span_t){ y, col, col + 1 });
+      }
+      break;
   }
 }
 
+// width x height cells around (col, row)
 void
-pixel_buffer_load(pixel_buffer_t* buffer, const char* filename)
+pixel_spans_rect(pixel_spans_t* spans, i32 col, i32 row, u32 width, u32 height)
 {
-  FILE* file = fopen(filename, "rb");
-  if (file != NULL) {
-    (void)fread(&buffer->count, sizeof(u32), 1, file);
-    buffer->pixels = malloc(sizeof(pixel_t) * buffer->count);
-    (void)fread(buffer->pixels, sizeof(pixel_t), buffer->count, file);
-    fclose(file);
+  i32 min_col = col - (i32)(width / 2);
+  i32 min_row = row - (i32)(height / 2);
+  for (i32 y = min_row; y < min_row + (i32)height; y++) {
+    pixel_spans_push(spans, (pixel_span_t){ y, min_col, min_col + (i32)width });
   }
 }
 
+// border of pixel_spans_rect, the top and bottom edges one cell longer
 void
-update_pixel_simulation(pixel_buffer_t* buffer)
+pixel_spans_rect_outline(pixel_spans_t* spans, i32 col, i32 row, u32 width, u32 height)
 {
+  i32 left = col - (i32)(width / 2);
+  i32 right = col + (i32)(width / 2);
+  i32 top = row - (i32)(height / 2);
+  i32 bottom = row + (i32)(height / 2);
+
+  pixel_spans_push(spans, (pixel_span_t){ top, left, left + (i32)width + 1 });
+  if (bottom != top) {
+    pixel_spans_push(spans, (pixel_span_t){ bottom, left, left + (i32)width + 1 });
+  }
 
-  u32 count = buffer->count;
-  for (u32 i = 0; i < count; i++) {
-    pixel_t* pixel = &buffer->pixels[i];
-
-    if (pixel->row >= GRID_HEIGHT - 1) {
+  // the sides, where the edges above did not cover them already
+  for (i32 y = top + 1; y < top + (i32)height; y++) {
+    if (y == bottom) {
       continue;
     }
-
-    pixel_t* below_pixel = NULL;
-    for (u32 j = 0; j < count; j++) {
-      if (buffer->pixels[j].col == pixel->col && buffer->pixels[j].row == pixel->row + 1) {
-        below_pixel = &buffer->pixels[j];
-        break;
-      }
+    pixel_spans_push(spans, (pixel_span_t){ y, left, left + 1 });
+    if (right != left) {
+      pixel_spans_push(spans, (pixel_span_t){ y, right, right + 1 });
     }
+  }
+}
 
-    if (below_pixel == NULL) {
-      pixel->row++;
-    } else {
-
-      if (PIXEL_TYPE_FIRE == pixel->type) {
+internal int
+pixel_span__compare(const void* a, const void* b)
+{
+  const pixel_span_t* x = (const pixel_span_t*)a;
+  const pixel_span_t* y = (const pixel_span_t*)b;
+  if (x->row != y->row) {
+    return x->row < y->row ? -1 : 1;
+  }
+  if (x->min_col != y->min_col) {
+    return x->min_col < y->min_col ? -1 : 1;
+  }
+  return 0;
+}
 
-        if (pixel->col > 0 && pixel->col < GRID_WIDTH - 1) {
+// Sorts the spans by row and merges the ones that overlap or touch, every
+// cell is covered by exactly one span afterwards.
+void
+pixel_spans_coalesce(pixel_spans_t* spans)
+{
+  if (spans->count < 2) {
+    return;
+  }
 
-          pixel_t* left_pixel = NULL;
-          pixel_t* right_pixel = NULL;
-          pixel_t* left_below_pixel = NULL;
-          pixel_t* right_below_pixel = NULL;
-          pixel_t* above_pixel = NULL;
+  qsort(spans->items, spans->count, sizeof(pixel_span_t), pixel_span__compare);
 
-          for (u32 j = 0; j < buffer->count; j++) {
+  u32 count = 1;
+  for (u32 i = 1; i < spans->count; i++) {
+    pixel_span_t* last = &spans->items[count - 1];
+    pixel_span_t span = spans->items[i];
+    if (span.row == last->row && span.min_col <= last->max_col) {
+      last->max_col = MAX(last->max_col, span.max_col);
+    } else {
+      spans->items[count++] = span;
+    }
+  }
+  spans->count = count;
+}
 
-            if (buffer->pixels[j].col == pixel->col - 1 && buffer->pixels[j].row == pixel->row) {
-              left_pixel = &buffer->pixels[j];
-            }
+// whether `cell` belongs to the region of a fill, see pixel_buffer_fill
+internal bool
+pixel_buffer__fills(pixel_buffer_t* buffer, u32 cell, u8 material, bool* colors)
+{
+  u8 other = buffer->cells[cell];
+  if (colors == NULL || other == GRID_CELL_EMPTY || material == GRID_CELL_EMPTY) {
+    return other == material;
+  }
+  return colors[buffer->colors[cell]];
+}
 
-            if (buffer->pixels[j].col == pixel->col + 1 && buffer->pixels[j].row == pixel->row) {
-              right_pixel = &buffer->pixels[j];
-            }
+// First cell from `cell` on, up to `limit`, that does not fill. Filling by
+// material compares eight cells at a time.
+internal u32
+pixel_buffer__fill_run(pixel_buffer_t* buffer, u32 cell, u32 limit, u8 material, bool* colors)
+{
+  if (colors == NULL || material == GRID_CELL_EMPTY) {
+    u64 pattern = (u64)material * 0x0101010101010101ull;
+    while (cell + 8 <= limit) {
+      u64 eight;
+      memcpy(&eight, buffer->cells + cell, sizeof(eight));
+      if (eight != pattern) {
+        break;
+      }
+      cell += 8;
+    }
+  }
+  while (cell < limit && pixel_buffer__fills(buffer, cell, material, colors)) {
+    cell++;
+  }
+  return cell;
+}
 
-            if (buffer->pixels[j].col == pixel->col - 1 && buffer->pixels[j].row == pixel->row + 1) {
-              left_below_pixel = &buffer->pixels[j];
-            }
+// Paints (or erases) the 4-connected region around the pixel: the cells that
+// match the clicked one by color or by material. Scanline fill, every row of
+// the region is found as whole runs of matching cells and the rows above and
+// below are searched along them. Runs still to look at wait on a heap stack,
+// so no region is too big, and the region is written with one
+// pixel_buffer_stamp.
+void
+pixel_buffer_fill(pixel_buffer_t* buffer, pixel_t pixel, pixel_fill_mode_t mode, bool erase)
+{
+  if (pixel.col >= buffer->width || pixel.row >= buffer->height) {
+    return;
+  }
 
-            if (buffer->pixels[j].col == pixel->col + 1 && buffer->pixels[j].row == pixel->row + 1) {
-              right_below_pixel = &buffer->pixels[j];
-            }
+  u8* cells = pixel_buffer__cells(buffer);
+  u32 width = buffer->width;
+  u32 start = pixel.row * width + pixel.col;
+  u8 material = cells[start];
+  if (erase && material == GRID_CELL_EMPTY) {
+    return;
+  }
 
-            if (buffer->pixels[j].col == pixel->col && buffer->pixels[j].row == pixel->row - 1) {
-              above_pixel = &buffer->pixels[j];
-            }
+  // palette entries that look like the clicked cell, several can
+  bool colors[PIXEL_PALETTE_SIZE];
+  bool* match = NULL;
+  if (mode == PIXEL_FILL_COLOR) {
+    u32 packed = pixel__pack_color(buffer->palette[buffer->colors[start]]);
+    for (u32 i = 0; i < PIXEL_PALETTE_SIZE; i++) {
+      colors[i] = i < buffer->palette_count && pixel__pack_color(buffer->palette[i]) == packed;
+    }
+    match = colors;
+  }
 
-          }
+  // One bit per cell, set for the runs already in the region, so a region
+  // that still matches after the fill is only walked once. A run is always
+  // taken whole, checking one of its cells is enough.
+  u64* visited = (u64*)calloc(((u64)width * buffer->height + 63) / 64, sizeof(u64));
+  pixel_spans_t stack = { 0 };
+  pixel_spans_t region = { 0 };
+  pixel_spans_push(&stack, (pixel_span_t){ (i32)pixel.row, (i32)pixel.col, (i32)pixel.col + 1 });
+
+  while (stack.count > 0) {
+    pixel_span_t seed = stack.items[--stack.count];
+    u32 row = (u32)seed.row;
+    u32 first = row * width;
+    u32 cell = first + (u32)seed.min_col;
+    if ((visited[cell / 64] >> (cell % 64)) & 1) {
+      continue;
+    }
 
-          if (left_below_pixel == NULL && left_pixel != NULL) {
-            pixel->col--;
-          } else if (right_below_pixel == NULL && right_pixel != NULL) {
-            pixel->col++;
-          } else if (above_pixel == NULL) {
-            pixel->row--;
-          } else {
-            if (left_pixel == NULL) {
-              pixel->col--;
-            } else if (right_pixel == NULL) {
-              pixel->col++;
-            }
-          }
+    u32 left = cell;
+    while (left > first && pixel_buffer__fills(buffer, left - 1, material, match)) {
+      left--;
+    }
+    u32 right = pixel_buffer__fill_run(buffer, cell + 1, first + width, material, match);
+
+    for (u32 i = left; i < right;) {
+      u32 bits = MIN(64 - i % 64, right - i);
+      visited[i / 64] |= (bits == 64 ? ~(u64)0 : (((u64)1 << bits) - 1)) << (i % 64);
+      i += bits;
+    }
+    pixel_spans_push(&region, (pixel_span_t){ (i32)row, (i32)(left - first), (i32)(right - first) });
+
+    // one seed per run next to this one that is not in the region yet
+    for (i32 next = (i32)row - 1; next <= (i32)row + 1; next += 2) {
+      if (next < 0 || (u32)next >= buffer->height) {
+        continue;
+      }
+      u32 next_first = (u32)next * width;
+      u32 other = next_first + (left - first);
+      u32 limit = next_first + (right - first);
+      while (other < limit) {
+        if (!pixel_buffer__fills(buffer, other, material, match)) {
+          other++;
+          continue;
+        }
+        if (!((visited[other / 64] >> (other % 64)) & 1)) {
+          pixel_spans_push(&stack, (pixel_span_t){ next, (i32)(other - next_first), (i32)(other - next_first) + 1 });
         }
+        other = pixel_buffer__fill_run(buffer, other + 1, limit, material, match);
       }
+    }
+  }
 
-      else if (PIXEL_TYPE_SAND == pixel->type) {
-
-        if (pixel->col > 0 && pixel->col < GRID_WIDTH - 1) {
-          pixel_t* left_pixel = NULL;
-          pixel_t* right_pixel = NULL;
-          for (u32 j = 0; j < buffer->count; j++) {
-            if (buffer->pixels[j].col == pixel->col - 1 && buffer->pixels[j].row == pixel->row + 1) {
-              left_pixel = &buffer->pixels[j];
-            } else if (buffer->pixels[j].col == pixel->col + 1 && buffer->pixels[j].row == pixel->row + 1) {
-              right_pixel = &buffer->pixels[j];
-            }
-          }
+  pixel_buffer_stamp(buffer, region.items, region.count, pixel, erase);
 
-          if (left_pixel == NULL) {
-            pixel->col--;
-          } else if (right_pixel == NULL) {
-            pixel->col++;
-          }
+  pixel_spans_free(&region);
+  pixel_spans_free(&stack);
+  free(visited);
+}
 
-        } else if (pixel->col < GRID_WIDTH - 1) {
-          pixel_t* right_pixel = NULL;
-          for (u32 j = 0; j < buffer->count; j++) {
-            if (buffer->pixels[j].col == pixel->col + 1 && buffer->pixels[j].row == pixel->row + 1) {
-              right_pixel = &buffer->pixels[j];
-            }
-          }
+// the buffer's own span list, emptied
+internal pixel_spans_t*
+pixel_buffer__spans(pixel_buffer_t* buffer)
+{
+  buffer->spans.count = 0;
+  return &buffer->spans;
+}
+
+void
+pixel_buffer_add_circle(pixel_buffer_t* buffer, pixel_t pixel, u32 radius, bool erase)
+{
+  pixel_spans_t* spans = pixel_buffer__spans(buffer);
+  pixel_spans_circle(spans, (i32)pixel.col, (i32)pixel.row, radius);
+  pixel_buffer_stamp(buffer, spans->items, spans->count, pixel, erase);
+}
+
+void
+pixel_buffer_add_line(pixel_buffer_t* buffer, pixel_t pixel, u32 length, u32 direction, bool erase)
+{
+  pixel_spans_t* spans = pixel_buffer__spans(buffer);
+  pixel_spans_line(spans, (i32)pixel.col, (i32)pixel.row, length, direction);
+  pixel_buffer_stamp(buffer, spans->items, spans->count, pixel, erase);
+}
+
+void
+pixel_buffer_add_rect(pixel_buffer_t* buffer, pixel_t pixel, u32 width, u32 height, bool erase)
+{
+  pixel_spans_t* spans = pixel_buffer__spans(buffer);
+  pixel_spans_rect(spans, (i32)pixel.col, (i32)pixel.row, width, height);
+  pixel_buffer_stamp(buffer, spans->items, spans->count, pixel, erase);
+}
+
+void
+pixel_buffer_add_rect_outline(pixel_buffer_t* buffer, pixel_t pixel, u32 width, u32 height, bool erase)
+{
+  pixel_spans_t* spans = pixel_buffer__spans(buffer);
+  pixel_spans_rect_outline(spans, (i32)pixel.col, (i32)pixel.row, width, height);
+  pixel_buffer_stamp(buffer, spans->items, spans->count, pixel, erase);
+}
+
+void
+pixel_buffer_clear(pixel_buffer_t* buffer)
+{
+  buffer->count = 0;
+  buffer->palette_count = 0;
+  buffer->palette_last = 0;
+  memset(buffer->palette_uses, 0, sizeof(buffer->palette_uses));
+  if (buffer->cells != NULL) {
+    memset(buffer->cells, GRID_CELL_EMPTY, sizeof(u8) * buffer->width * buffer->height);
+    memset(buffer->colors, 0, sizeof(u8) * buffer->width * buffer->height);
+    for (u32 i = 0; i < buffer->chunk_cols * buffer->chunk_rows; i++) {
+      buffer->chunks[i].changed = 1;
+    }
+  }
+}
+
+void
+pixel_buffer_remove_all(pixel_buffer_t* buffer, u32 col, u32 row)
+{
+  if (pixel_buffer_is_empty(buffer, col, row)) {
+    return;
+  }
 
-          if (right_pixel == NULL) {
-            pixel->col++;
+  u32 cell = row * buffer->width + col;
+  buffer->cells[cell] = GRID_CELL_EMPTY;
+  buffer->palette_uses[buffer->colors[cell]]--;
+  buffer->count--;
+  pixel_buffer_wake(buffer, col, row);
+}
+
+// out of bounds counts as empty
+bool
+pixel_buffer_is_empty(pixel_buffer_t* buffer, u32 col, u32 row)
+{
+  if (buffer->cells == NULL || col >= buffer->width || row >= buffer->height) {
+    return true;
+  }
+  return buffer->cells[row * buffer->width + col] == GRID_CELL_EMPTY;
+}
+
+// cells are drawn camera->zoom screen pixels wide, centered in the window
+void
+pixel_buffer_draw(pixel_buffer_t* buffer, app_camera_t* camera, SDL_Renderer* renderer)
+{
+  if (buffer->cells == NULL) {
+    return;
+  }
+
+  i32 zoom = camera->zoom;
+  i32 origin_x = (WINDOW_WIDTH - (i32)buffer->width * zoom) / 2 + camera->x;
+  i32 origin_y = (WINDOW_HEIGHT - (i32)buffer->height * zoom) / 2 + camera->y;
+
+  for (u32 row = 0; row < buffer->height; row++) {
+    for (u32 col = 0; col < buffer->width; col++) {
+      u32 cell = row * buffer->width + col;
+      if (buffer->cells[cell] == GRID_CELL_EMPTY) {
+        continue;
+      }
+
+      SDL_Rect rect = {
+        .x = origin_x + (i32)col * zoom,
+        .y = origin_y + (i32)row * zoom,
+        .w = zoom,
+        .h = zoom,
+      };
+
+      SDL_Color color = pixel_buffer_cell_color(buffer, cell);
+
+      SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+      SDL_RenderFillRect(renderer, &rect);
+    }
+  }
+}
+
+// darkens the pixel when one of the cells `radius` away from it is empty
+void
+pixel_buffer_shade_pixel(pixel_buffer_t* buffer, u32 col, u32 row, u32 radius)
+{
+  if (pixel_buffer_is_empty(buffer, col, row)) {
+    return;
+  }
+
+  pixel_t pixel = pixel_buffer_get_pixel(buffer, col, row);
+  SDL_Color *color = &pixel.color;
+  if (pixel_buffer_is_empty(buffer, col - radius, row) ||
+      pixel_buffer_is_empty(buffer, col + radius, row) ||
+      pixel_buffer_is_empty(buffer, col, row - radius) ||
+      pixel_buffer_is_empty(buffer, col, row + radius)) {
+    color->r /= 1.5;
+    color->g /= 1.5;
+    color->b /= 1.5;
+    pixel_buffer_set_pixel(buffer, pixel);
+  }
+}
+
+// Repeats every pixel of `in` `scale` times into `out`, which has room for
+// width * scale + 3 pixels: the wide copies store 4 pixels at a time and may
+// write up to 3 past the end.
+internal void
+pixel__scale_row(u32* out, const u32* in, u32 width, u32 scale)
+{
+  if (scale == 1) {
+    memcpy(out, in, sizeof(u32) * width);
+    return;
+  }
+
+  u32 col = 0;
+#if defined(__SSE2__)
+  if (scale == 2) {
+    for (; col + 4 <= width; col += 4) {
+      __m128i pixels = _mm_loadu_si128((const __m128i*)(in + col));
+      _mm_storeu_si128((__m128i*)(out + col * 2), _mm_unpacklo_epi32(pixels, pixels));
+      _mm_storeu_si128((__m128i*)(out + col * 2 + 4), _mm_unpackhi_epi32(pixels, pixels));
+    }
+  } else {
+    for (; col < width; col++) {
+      __m128i pixel = _mm_set1_epi32((int)in[col]);
+      u32* run = out + col * scale;
+      for (u32 i = 0; i < scale; i += 4) {
+        _mm_storeu_si128((__m128i*)(run + i), pixel);
+      }
+    }
+  }
+#endif
+
+  for (; col < width; col++) {
+    u32 pixel = in[col];
+    u32* run = out + col * scale;
+    for (u32 i = 0; i < scale; i++) {
+      run[i] = pixel;
+    }
+  }
+}
+
+// Exports the frame at several scales from one pass over it, scales[i] output
+// pixels per cell into filenames[i]. Every grid row is turned into colors
+// once, then widened into each image (see pixel__scale_row) and copied down
+// the rows below it. Empty cells are transparent. False when any image could
+// not be made or written.
+bool
+pixel_buffer_save_pngs(pixel_buffer_t* buffer, const char** filenames, const u32* scales, u32 count)
+{
+  SDL_Surface** surfaces = (SDL_Surface**)calloc(MAX(count, 1), sizeof(SDL_Surface*));
+  u32 widest = 1;
+  bool saved = true;
+  for (u32 i = 0; i < count; i++) {
+    u32 scale = MAX(scales[i], 1);
+    if ((u64)buffer->width * scale > INT32_MAX / 4 || (u64)buffer->height * scale > INT32_MAX) {
+      saved = false;
+      continue;
+    }
+    surfaces[i] = SDL_CreateRGBSurfaceWithFormat(0, (int)(buffer->width * scale), (int)(buffer->height * scale), 32, SDL_PIXELFORMAT_RGBA32);
+    saved = saved && surfaces[i] != NULL;
+    widest = MAX(widest, buffer->width * scale);
+  }
+
+  // RGBA32 is r, g, b, a in memory whatever the byte order
+  u32 palette[PIXEL_PALETTE_SIZE];
+  for (u32 i = 0; i < buffer->palette_count; i++) {
+    u8 rgba[4] = { buffer->palette[i].r, buffer->palette[i].g, buffer->palette[i].b, buffer->palette[i].a };
+    memcpy(&palette[i], rgba, sizeof(u32));
+  }
+
+  u32* colors = (u32*)malloc(sizeof(u32) * buffer->width);
+  u32* scaled = (u32*)malloc(sizeof(u32) * (widest + 3));
+  for (u32 row = 0; buffer->cells != NULL && row < buffer->height; row++) {
+    const u8* cells = buffer->cells + row * buffer->width;
+    const u8* indexes = buffer->colors + row * buffer->width;
+    for (u32 col = 0; col < buffer->width; col++) {
+      colors[col] = cells[col] == GRID_CELL_EMPTY ? 0 : palette[indexes[col]];
+    }
+
+    for (u32 i = 0; i < count; i++) {
+      SDL_Surface* surface = surfaces[i];
+      if (surface == NULL) {
+        continue;
+      }
+
+      u32 scale = MAX(scales[i], 1);
+      sz_t bytes = sizeof(u32) * buffer->width * scale;
+      u8* first = (u8*)surface->pixels + (sz_t)row * scale * (sz_t)surface->pitch;
+      pixel__scale_row(scaled, colors, buffer->width, scale);
+      for (u32 copy = 0; copy < scale; copy++) {
+        memcpy(first + (sz_t)copy * (sz_t)surface->pitch, scaled, bytes);
+      }
+    }
+  }
+  free(scaled);
+  free(colors);
+
+  for (u32 i = 0; i < count; i++) {
+    if (surfaces[i] != NULL) {
+      saved = IMG_SavePNG(surfaces[i], filenames[i]) == 0 && saved;
+      SDL_FreeSurface(surfaces[i]);
+    }
+  }
+  free(surfaces);
+  return saved;
+}
+
+bool
+pixel_buffer_save_png(pixel_buffer_t* buffer, const char* filename, u32 scale)
+{
+  return pixel_buffer_save_pngs(buffer, &filename, &scale, 1);
+}
+
+// empty cells come back as a transparent pixel
+pixel_t
+pixel_buffer_get_pixel(pixel_buffer_t* buffer, u32 col, u32 row)
+{
+  pixel_t pixel = { 0 };
+  pixel.col = col;
+  pixel.row = row;
+
+  if (!pixel_buffer_is_empty(buffer, col, row)) {
+    u32 cell = row * buffer->width + col;
+    pixel.type = pixel_material_to_type(buffer->cells[cell]);
+    pixel.color = pixel_buffer_cell_color(buffer, cell);
+  }
+
+  return pixel;
+}
+
+void
+pixel_buffer_set_pixel(pixel_buffer_t* buffer, pixel_t pixel)
+{
+  // replacing an existing cell is exactly what pixel_buffer_add does
+  pixel_buffer_add(buffer, pixel);
+}
+
+internal inline u32
+pixel_lut_at(u8 r, u8 g, u8 b)
+{
+  return (u32)(r >> (8 - PIXEL_LUT_BITS)) << (2 * PIXEL_LUT_BITS) |
+         (u32)(g >> (8 - PIXEL_LUT_BITS)) << PIXEL_LUT_BITS |
+         (u32)(b >> (8 - PIXEL_LUT_BITS));
+}
+
+// For every cell of the table the palette color closest to its center, by
+// squared distance in RGB. The first of equally close colors wins.
+void
+pixel_lut_build(pixel_lut_t* lut, const SDL_Color* palette, u32 count)
+{
+  const i32 side = 1 << PIXEL_LUT_BITS;
+  const i32 step = 1 << (8 - PIXEL_LUT_BITS);
+  for (i32 r = 0; r < side; r++) {
+    for (i32 g = 0; g < side; g++) {
+      for (i32 b = 0; b < side; b++) {
+        i32 red = r * step + step / 2;
+        i32 green = g * step + step / 2;
+        i32 blue = b * step + step / 2;
+
+        u32 nearest = 0;
+        i32 nearest_distance = INT32_MAX;
+        for (u32 i = 0; i < count; i++) {
+          i32 dr = palette[i].r - red;
+          i32 dg = palette[i].g - green;
+          i32 db = palette[i].b - blue;
+          i32 distance = dr * dr + dg * dg + db * db;
+          if (distance < nearest_distance) {
+            nearest = i;
+            nearest_distance = distance;
           }
         }
+        lut->index[(r * side + g) * side + b] = (u8)nearest;
+      }
+    }
+  }
+}
 
-        if (below_pixel == PIXEL_TYPE_WATER) {
-          below_pixel->type = PIXEL_TYPE_SAND;
-        }
+// Exact colors go through a small direct mapped cache in front of
+// pixel_buffer__color_index. Once the palette is full a color still keeps its
+// own entry when it has one, found in a hash of the palette, and only the
+// colors that are not in it take the nearest one through a LUT of the palette
+// instead of searching it.
+#define PIXEL_IMPORT_CACHE 4096
+#define PIXEL_IMPORT_PALETTE (PIXEL_PALETTE_SIZE * 2)
 
-      } else if (PIXEL_TYPE_WATER == pixel->type) {
-
-        if (pixel->col > 0 && pixel->col < GRID_WIDTH - 1) {
-          pixel_t* left_pixel = NULL;
-          pixel_t* right_pixel = NULL;
-          for (u32 j = 0; j < buffer->count; j++) {
-            if (buffer->pixels[j].col == pixel->col - 1 && buffer->pixels[j].row == pixel->row) {
-              left_pixel = &buffer->pixels[j];
-            } else if (buffer->pixels[j].col == pixel->col + 1 && buffer->pixels[j].row == pixel->row) {
-              right_pixel = &buffer->pixels[j];
-            }
-          }
+typedef struct
+{
+  u32 keys[PIXEL_IMPORT_CACHE]; // packed colors, 0 (transparent) is never looked up
+  u8 values[PIXEL_IMPORT_CACHE];
+  pixel_lut_t* lut;
+  // open addressing, built with the LUT, 0 is a free slot
+  u32 palette_keys[PIXEL_IMPORT_PALETTE];
+  u8 palette_values[PIXEL_IMPORT_PALETTE];
+  // one bit per cell of the LUT with a palette color in it, most colors of a
+  // photo skip the hash
+  u8 palette_cells[PIXEL_LUT_SIZE / 8];
+} pixel_import_cache_t;
+
+internal inline u32
+pixel_import__palette_slot(u32 packed)
+{
+  return (packed * 2654435761u) >> 23;
+}
 
-          if (left_pixel == NULL) {
-            pixel->col--;
-          } else if (right_pixel == NULL) {
-            pixel->col++;
-          }
+internal void
+pixel_import__build(pixel_import_cache_t* cache, const SDL_Color* palette, u32 count)
+{
+  cache->lut = (pixel_lut_t*)malloc(sizeof(pixel_lut_t));
+  pixel_lut_build(cache->lut, palette, count);
 
-        } else if (pixel->col < GRID_WIDTH - 1) {
-          pixel_t* right_pixel = NULL;
-          for (u32 j = 0; j < buffer->count; j++) {
-            if (buffer->pixels[j].col == pixel->col + 1 && buffer->pixels[j].row == pixel->row) {
-              right_pixel = &buffer->pixels[j];
-            }
-          }
-          if (right_pixel == NULL) {
-            pixel->col++;
-          }
+  // the first of equal entries wins, like a search of the palette
+  memset(cache->palette_keys, 0, sizeof(cache->palette_keys));
+  memset(cache->palette_cells, 0, sizeof(cache->palette_cells));
+  for (u32 i = 0; i < count; i++) {
+    u32 packed = pixel__pack_color(palette[i]);
+    if (packed == 0) {
+      continue;
+    }
+    u32 cell = pixel_lut_at(palette[i].r, palette[i].g, palette[i].b);
+    cache->palette_cells[cell >> 3] |= (u8)(1 << (cell & 7));
+    u32 slot = pixel_import__palette_slot(packed);
+    while (cache->palette_keys[slot] != 0 && cache->palette_keys[slot] != packed) {
+      slot = (slot + 1) % PIXEL_IMPORT_PALETTE;
+    }
+    if (cache->palette_keys[slot] == 0) {
+      cache->palette_keys[slot] = packed;
+      cache->palette_values[slot] = (u8)i;
+    }
+  }
+}
+
+// palette index of an exact match, the LUT's nearest color otherwise
+internal u8
+pixel_import__lookup(pixel_import_cache_t* cache, u32 packed, const u8* rgba)
+{
+  u32 cell = pixel_lut_at(rgba[0], rgba[1], rgba[2]);
+  if (cache->palette_cells[cell >> 3] & (1 << (cell & 7))) {
+    u32 slot = pixel_import__palette_slot(packed);
+    while (cache->palette_keys[slot] != 0) {
+      if (cache->palette_keys[slot] == packed) {
+        return cache->palette_values[slot];
+      }
+      slot = (slot + 1) % PIXEL_IMPORT_PALETTE;
+    }
+  }
+  return cache->lut->index[cell];
+}
+
+internal u8
+pixel_buffer__import_color(pixel_buffer_t* buffer, pixel_import_cache_t* cache, const u8* rgba)
+{
+  u32 packed = (u32)rgba[0] << 24 | (u32)rgba[1] << 16 | (u32)rgba[2] << 8 | rgba[3];
+  u32 slot = (packed * 2654435761u) >> 20;
+  if (cache->keys[slot] == packed) {
+    return cache->values[slot];
+  }
+
+  u8 index = 0;
+  if (cache->lut != NULL) {
+    index = pixel_import__lookup(cache, packed, rgba);
+  } else if (buffer->palette_count < PIXEL_PALETTE_SIZE) {
+    index = pixel_buffer__color_index(buffer, (SDL_Color){ rgba[0], rgba[1], rgba[2], rgba[3] });
+  } else {
+    pixel_import__build(cache, buffer->palette, buffer->palette_count);
+    index = pixel_import__lookup(cache, packed, rgba);
+  }
+
+  cache->keys[slot] = packed;
+  cache->values[slot] = index;
+  return index;
+}
+
+// Replaces the frame with the image, one cell for every `scale` x `scale`
+// block of pixels (its top left pixel). Fully transparent pixels are left
+// empty, the rest become water. The surface is converted to RGBA32 once, if
+// it is not already, and read row by row straight into the grids.
+bool
+pixel_buffer_import_surface(pixel_buffer_t* buffer, SDL_Surface* surface, int scale, pixel_import_mode_t mode)
+{
+  SDL_Surface* image = surface;
+  if (surface->format->format != SDL_PIXELFORMAT_RGBA32) {
+    image = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+    if (image == NULL) {
+      return false;
+    }
+  }
+  if (SDL_MUSTLOCK(image)) {
+    SDL_LockSurface(image);
+  }
+
+  u32 step = (u32)MAX(scale, 1);
+  pixel_buffer_clear(buffer);
+  pixel_buffer__set_size(buffer, ((u32)image->w + step - 1) / step, ((u32)image->h + step - 1) / step);
+
+  pixel_lut_t* lut = NULL;
+  pixel_import_cache_t* cache = NULL;
+  if (mode == PIXEL_IMPORT_C64) {
+    memcpy(buffer->palette, C64_COLORS, sizeof(SDL_Color) * C64_COLOR_COUNT);
+    buffer->palette_count = C64_COLOR_COUNT;
+    lut = (pixel_lut_t*)malloc(sizeof(pixel_lut_t));
+    pixel_lut_build(lut, buffer->palette, buffer->palette_count);
+  } else {
+    cache = (pixel_import_cache_t*)calloc(1, sizeof(pixel_import_cache_t));
+  }
+
+  u8 material = pixel_type_to_material(PIXEL_TYPE_WATER);
+  u32 count = 0;
+  for (u32 row = 0; row < buffer->height; row++) {
+    const u8* line = (const u8*)image->pixels + (sz_t)row * step * (sz_t)image->pitch;
+    u8* cells = buffer->cells + row * buffer->width;
+    u8* colors = buffer->colors + row * buffer->width;
+    for (u32 col = 0; col < buffer->width; col++) {
+      const u8* rgba = line + (sz_t)col * step * 4;
+      if (rgba[3] == 0) {
+        continue;
+      }
+
+      cells[col] = material;
+      if (lut != NULL) {
+        colors[col] = lut->index[pixel_lut_at(rgba[0], rgba[1], rgba[2])];
+      } else {
+        colors[col] = pixel_buffer__import_color(buffer, cache, rgba);
+      }
+      buffer->palette_uses[colors[col]]++;
+      count++;
+    }
+  }
+  buffer->count = count;
+
+  if (cache != NULL) {
+    free(cache->lut);
+    free(cache);
+  }
+  free(lut);
+  if (SDL_MUSTLOCK(image)) {
+    SDL_UnlockSurface(image);
+  }
+  if (image != surface) {
+    SDL_FreeSurface(image);
+  }
+
+  pixel_buffer_wake_all(buffer);
+  buffer->tick = 0;
+  return true;
+}
+
+// false when the image cannot be read
+bool
+png_to_pixel_buffer(pixel_buffer_t* buffer, const char* filename, int scale, pixel_import_mode_t mode)
+{
+  SDL_Surface* surface = IMG_Load(filename);
+  if (surface == NULL) {
+    return false;
+  }
+
+  bool imported = pixel_buffer_import_surface(buffer, surface, scale, mode);
+  SDL_FreeSurface(surface);
+  return imported;
+}
+
+// .psb files, version 2, every number little endian:
+//
+//   "PXSB"              PIXEL_PSB_MAGIC
+//   u32 version         PIXEL_PSB_VERSION
+//   u32 width, height   grid size in cells
+//   u32 palette_count   then that many colors, 4 bytes each, r g b a
+//   height rows, each a list of runs that add up to width cells:
+//     varint length     7 bits per byte, lowest first, high bit set on all
+//                       but the last byte
+//     u8 material       0 for empty cells, pixel type + 1 otherwise
+//     u8 color          palette index, only for occupied runs
+//   u32 checksum        FNV-1a of every byte before it
+//
+// Version 1 files have no header, see pixel_buffer__load_v1.
+#define PIXEL_PSB_MAGIC "PXSB"
+#define PIXEL_PSB_VERSION 2
+#define PIXEL_PSB_HEADER 20 // magic, version, width, height, palette count
+
+internal void
+pixel__put_u32(u8* out, u32 value)
+{
+  out[0] = (u8)value;
+  out[1] = (u8)(value >> 8);
+  out[2] = (u8)(value >> 16);
+  out[3] = (u8)(value >> 24);
+}
+
+internal u32
+pixel__get_u32(const u8* in)
+{
+  return (u32)in[0] | (u32)in[1] << 8 | (u32)in[2] << 16 | (u32)in[3] << 24;
+}
+
+internal u32
+pixel__checksum(u32 hash, const u8* data, sz_t size)
+{
+  for (sz_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+#define PIXEL_CHECKSUM_START 2166136261u
+
+// Runs of one row, `out` has room for 7 bytes per cell. Empty cells are one
+// run whatever is left in their color.
+internal u32
+pixel_buffer__encode_row(pixel_buffer_t* buffer, u32 row, u8* out)
+{
+  u32 size = 0;
+  u32 first = row * buffer->width;
+  u32 col = 0;
+  while (col < buffer->width) {
+    u8 material = buffer->cells != NULL ? buffer->cells[first + col] : GRID_CELL_EMPTY;
+    u8 color = material != GRID_CELL_EMPTY ? buffer->colors[first + col] : 0;
+
+    u32 length = 1;
+    if (material == GRID_CELL_EMPTY) {
+      while (col + length < buffer->width &&
+             (buffer->cells == NULL || buffer->cells[first + col + length] == GRID_CELL_EMPTY)) {
+        length++;
+      }
+    } else {
+      while (col + length < buffer->width && buffer->cells[first + col + length] == material &&
+             buffer->colors[first + col + length] == color) {
+        length++;
+      }
+    }
+
+    u32 value = length;
+    while (value >= 0x80) {
+      out[size++] = (u8)(value | 0x80);
+      value >>= 7;
+    }
+    out[size++] = (u8)value;
+    out[size++] = material;
+    if (material != GRID_CELL_EMPTY) {
+      out[size++] = color;
+    }
+    col += length;
+  }
+  return size;
+}
+
+// false when the file could not be written whole
+bool
+pixel_buffer_save(pixel_buffer_t* buffer, const char* filename)
+{
+  FILE* file = fopen(filename, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  u8 header[PIXEL_PSB_HEADER + PIXEL_PALETTE_SIZE * 4];
+  memcpy(header, PIXEL_PSB_MAGIC, 4);
+  pixel__put_u32(header + 4, PIXEL_PSB_VERSION);
+  pixel__put_u32(header + 8, buffer->width);
+  pixel__put_u32(header + 12, buffer->height);
+  pixel__put_u32(header + 16, buffer->palette_count);
+  for (u32 i = 0; i < buffer->palette_count; i++) {
+    SDL_Color color = buffer->palette[i];
+    u8* entry = header + PIXEL_PSB_HEADER + i * 4;
+    entry[0] = color.r;
+    entry[1] = color.g;
+    entry[2] = color.b;
+    entry[3] = color.a;
+  }
+  u32 header_size = PIXEL_PSB_HEADER + buffer->palette_count * 4;
+  u32 checksum = pixel__checksum(PIXEL_CHECKSUM_START, header, header_size);
+  bool written = fwrite(header, 1, header_size, file) == header_size;
+
+  // row by row, the file is written as it is encoded
+  u8* row_data = (u8*)malloc((sz_t)buffer->width * 7);
+  for (u32 row = 0; row < buffer->height; row++) {
+    u32 size = pixel_buffer__encode_row(buffer, row, row_data);
+    checksum = pixel__checksum(checksum, row_data, size);
+    written = written && fwrite(row_data, 1, size, file) == size;
+  }
+  free(row_data);
+
+  u8 footer[4];
+  pixel__put_u32(footer, checksum);
+  written = written && fwrite(footer, 1, sizeof(footer), file) == sizeof(footer);
+  return fclose(file) == 0 && written;
+}
+
+// Fills the grids from the runs in data[at, end), one pass straight into
+// them. False when the runs do not add up to the grid.
+internal bool
+pixel_buffer__decode_runs(pixel_buffer_t* buffer, const u8* data, sz_t at, sz_t end)
+{
+  u32 count = 0;
+  u32 cell = 0;
+  for (u32 row = 0; row < buffer->height; row++) {
+    u32 row_end = cell + buffer->width;
+    while (cell < row_end) {
+      u32 length = 0;
+      u32 shift = 0;
+      u8 byte = 0x80;
+      while (byte & 0x80) {
+        if (at >= end || shift > 28) {
+          return false;
         }
+        byte = data[at++];
+        length |= (u32)(byte & 0x7f) << shift;
+        shift += 7;
       }
+
+      if (at >= end || length == 0 || length > row_end - cell) {
+        return false;
+      }
+      u8 material = data[at++];
+      u8 color = 0;
+      if (material != GRID_CELL_EMPTY) {
+        if (at >= end || data[at] >= buffer->palette_count) {
+          return false;
+        }
+        color = data[at++];
+        // types this build does not know share one id, as in
+        // pixel_type_to_material
+        material = MIN(material, (u8)(PIXEL_TYPE_COUNT + 1));
+        count += length;
+        buffer->palette_uses[color] += length;
+      }
+
+      memset(buffer->cells + cell, material, length);
+      memset(buffer->colors + cell, color, length);
+      cell += length;
+    }
+  }
+
+  buffer->count = count;
+  return at == end;
+}
+
+// Version 2 files, see pixel_buffer_save. False for anything that is not
+// one, the frame is only touched once the header and checksum hold up (and
+// left empty if the runs then do not).
+internal bool
+pixel_buffer__load_v2(pixel_buffer_t* buffer, const u8* data, sz_t size)
+{
+  if (size < PIXEL_PSB_HEADER + 4 || memcmp(data, PIXEL_PSB_MAGIC, 4) != 0 ||
+      pixel__get_u32(data + 4) != PIXEL_PSB_VERSION) {
+    return false;
+  }
+
+  u32 width = pixel__get_u32(data + 8);
+  u32 height = pixel__get_u32(data + 12);
+  u32 palette_count = pixel__get_u32(data + 16);
+  sz_t at = PIXEL_PSB_HEADER + (sz_t)palette_count * 4;
+  // sizes a frame cannot take would be clamped, and the runs then no longer fit
+  if (width == 0 || height == 0 || width > GRID_MAX_WIDTH || height > GRID_MAX_HEIGHT ||
+      palette_count > PIXEL_PALETTE_SIZE || at > size - 4 ||
+      pixel__checksum(PIXEL_CHECKSUM_START, data, size - 4) != pixel__get_u32(data + size - 4)) {
+    return false;
+  }
+
+  pixel_buffer_clear(buffer);
+  pixel_buffer__set_size(buffer, width, height);
+  for (u32 i = 0; i < palette_count; i++) {
+    const u8* entry = data + PIXEL_PSB_HEADER + i * 4;
+    buffer->palette[i] = (SDL_Color){ entry[0], entry[1], entry[2], entry[3] };
+  }
+  buffer->palette_count = palette_count;
+
+  if (!pixel_buffer__decode_runs(buffer, data, at, size - 4)) {
+    pixel_buffer_clear(buffer);
+    return false;
+  }
+
+  pixel_buffer_wake_all(buffer);
+  buffer->tick = 0;
+  return true;
+}
+
+// Pixel record of version 1 .psb files, the in memory pixel_t of the builds
+// that introduced the format, written as is. Kept apart from pixel_t so the
+// file layout does not change with it.
+typedef struct
+{
+  u32 col;
+  u32 row;
+  u8 size; // zoom at the time of saving, ignored
+  pixel_type_t type;
+  SDL_Color color;
+} pixel_record_t;
+
+// Version 1 files: a u32 record count and the records, nothing else. The
+// records are read where they lie in `data`, one at a time since they need
+// not be aligned there. There is no header or checksum to go by, so the file
+// has to be exactly the size its count says and every record has to make
+// sense, all checked before the frame is touched.
+internal bool
+pixel_buffer__load_v1(pixel_buffer_t* buffer, const u8* data, sz_t size)
+{
+  if (size < sizeof(u32)) {
+    return false;
+  }
+
+  u32 count = 0;
+  memcpy(&count, data, sizeof(u32));
+  // the writer always made exactly this many bytes
+  if (size - sizeof(u32) != (sz_t)count * sizeof(pixel_record_t)) {
+    return false;
+  }
+  const u8* records = data + sizeof(u32);
+
+  // the file has no header, so the grid is sized to fit every pixel, and
+  // never smaller than the default canvas the file was drawn on
+  u32 width = GRID_WIDTH;
+  u32 height = GRID_HEIGHT;
+  for (u32 i = 0; i < count; i++) {
+    pixel_record_t record;
+    memcpy(&record, records + (sz_t)i * sizeof(pixel_record_t), sizeof(pixel_record_t));
+    if ((u32)record.type >= PIXEL_TYPE_COUNT || record.col >= GRID_MAX_WIDTH || record.row >= GRID_MAX_HEIGHT) {
+      return false;
     }
+    width = MAX(width, record.col + 1);
+    height = MAX(height, record.row + 1);
+  }
+
+  pixel_buffer_clear(buffer);
+  pixel_buffer__set_size(buffer, width, height);
+
+  // when two records share a cell the later one wins
+  for (u32 i = 0; i < count; i++) {
+    pixel_record_t record;
+    memcpy(&record, records + (sz_t)i * sizeof(pixel_record_t), sizeof(pixel_record_t));
+    pixel_t pixel = {
+      .col = record.col,
+      .row = record.row,
+      .type = record.type,
+      .color = record.color,
+    };
+    pixel_buffer__put(buffer, pixel);
+  }
+
+  pixel_buffer_wake_all(buffer);
+
+  buffer->tick = 0;
+
+  return true;
+}
+
+// Maps the file and decodes it straight out of the mapping, so loading costs
+// about what reading its pages in does, with no copy of the file on the heap.
+bool
+pixel_buffer_load(pixel_buffer_t* buffer, const char* filename)
+{
+  dk_file_map_t map;
+  if (!dk_file_map(filename, &map)) {
+    return false;
   }
+
+  // a version 1 file starts with its record count, which is very unlikely to
+  // spell the magic and then pass the checksum as well
+  bool loaded = pixel_buffer__load_v2(buffer, map.data, map.size);
+  if (!loaded && (map.size < 4 || memcmp(map.data, PIXEL_PSB_MAGIC, 4) != 0)) {
+    loaded = pixel_buffer__load_v1(buffer, map.data, map.size);
+  }
+  dk_file_unmap(&map);
+  return loaded;
 }
 
 SDL_Color
@@ -658,5 +1842,27 @@ pixel_type_to_color(pixel_type_t type)
   }
 }
 
+// Material id stored in pixel_buffer_t.cells. Zero is GRID_CELL_EMPTY, and
+// types this build does not know about (old or damaged files) all share one
+// id past the last known type, so the simulation still lets them fall.
+u8
+pixel_type_to_material(pixel_type_t type)
+{
+  if ((u32)type >= PIXEL_TYPE_COUNT) {
+    return (u8)(PIXEL_TYPE_COUNT + 1);
+  }
+  return (u8)(type + 1);
+}
+
+// unknown materials come back as PIXEL_TYPE_COUNT
+pixel_type_t
+pixel_material_to_type(u8 material)
+{
+  if (material == GRID_CELL_EMPTY || material > PIXEL_TYPE_COUNT) {
+    return PIXEL_TYPE_COUNT;
+  }
+  return (pixel_type_t)(material - 1);
+}
+
 #endif
 #endif // DK_PIXELBUFFER_H
@@ -0,0 +1,486 @@
+#if !defined(DK_SIMULATION_H)
+#define DK_SIMULATION_H
+
+#include <SDL2/SDL.h>
+
+#include "dk_pixelbuffer.h"
+#include "dk_macros.h"
+#include "dk.h"
+
+//
+// Cellular automaton engine. Works on the material grid of a pixel buffer
+// (pixel_buffer_t.cells), every neighbor read is an array access and a move
+// swaps two bytes of material and two bytes of color.
+//
+// Rules, evaluated chunk by chunk, bottom row first and left to right inside
+// a row:
+//  - everything falls when the cell below is free
+//  - sand slides to the side when the cell diagonally below is free
+//  - water spreads to a free cell on its left or right
+//  - fire pushes into its neighbors, then climbs, then spreads
+//
+// A particle only moves into a free cell, except fire which trades places
+// with whatever it pushes into. Cells a particle moved into are stamped with
+// the current tick, so nothing is updated twice.
+//
+// Only the dirty rectangles of awake chunks are visited (see pixel_chunk_t).
+// Every move wakes the neighborhood of both cells for the rest of the tick
+// and for the next one, so the result is the same as scanning every cell,
+// while a settled scene costs next to nothing.
+//
+// A tick runs in two phases, the even chunk columns then the odd ones. Every
+// column is one job, a strip of chunks walked bottom first like the rows of a
+// full grid scan, so a column falling across a chunk boundary moves as one
+// piece. Strips of the same phase are a whole chunk apart and a particle
+// moves at most one cell per tick, so they never touch the same cells and can
+// run on any number of threads, with two barriers per tick whatever the size
+// of the frame. The phases always run in the same order, on one thread or
+// many, which keeps the result identical for every thread count.
+//
+// The result only depends on the starting frame, the number of ticks and the
+// seed. Rules that need randomness take it from dk_simulation__random, which
+// is keyed by seed, tick and cell instead of the order cells are visited in.
+// dk_simulation_hash fingerprints a frame, so any engine change can be
+// checked tick by tick against dk_simulation_step_reference.
+//
+
+typedef struct
+{
+  SDL_Thread** threads;
+  u32 thread_count; // workers plus the thread calling dk_simulation_step
+  SDL_sem* start;
+  SDL_sem* done;
+  SDL_atomic_t next_job;
+  bool quit;
+
+  pixel_buffer_t* buffer;
+  u32* jobs; // chunk columns of the phase being run
+  u8* awake; // per chunk column, set when one of its chunks starts the tick awake
+  u32 job_count;
+  u32 job_capacity;
+} dk_simulation_pool_t;
+
+typedef struct
+{
+  u8* moved;
+  u32 moved_capacity;
+  u8 stamp;
+  dk_rng_t rng;
+  dk_rng_t tick_rng; // rng split off for the tick being run
+  dk_simulation_pool_t pool;
+} dk_simulation_t;
+
+void
+dk_simulation_step(pixel_buffer_t* buffer);
+
+void
+dk_simulation_step_reference(pixel_buffer_t* buffer);
+
+u64
+dk_simulation_hash(pixel_buffer_t* buffer);
+
+void
+dk_simulation_set_seed(u64 seed);
+
+void
+dk_simulation_set_thread_count(u32 count);
+
+u32
+dk_simulation_get_thread_count(void);
+
+void
+dk_simulation_destroy(void);
+
+#if defined(DK_SIMULATION_IMPLEMENTATION)
+
+// scratch shared by all frames, only one of them is simulated at a time
+static dk_simulation_t dk_simulation = { 0 };
+
+// the same value for the same seed, tick, cell and draw on any thread, draw
+// tells apart several numbers needed by one cell in one tick
+internal inline u64
+dk_simulation__random(u32 cell, u8 draw)
+{
+  return dk_rng_at(dk_simulation.tick_rng, (u64)cell << 8 | draw);
+}
+
+internal void
+dk_simulation__move(pixel_buffer_t* buffer, u8* moved, u32 from, u32 to)
+{
+  pixel_buffer_swap_cells(buffer, from, to);
+  moved[from] = dk_simulation.stamp;
+  moved[to] = dk_simulation.stamp;
+}
+
+internal void
+dk_simulation__update_cell(pixel_buffer_t* buffer, u8* moved, u32 col, u32 row)
+{
+  u8* cells = buffer->cells;
+  u32 width = buffer->width;
+  u32 cell = row * width + col;
+  u8 material = cells[cell];
+
+  if (material == GRID_CELL_EMPTY || moved[cell] == dk_simulation.stamp) {
+    return;
+  }
+
+  u32 below = cell + width;
+  if (cells[below] == GRID_CELL_EMPTY) {
+    dk_simulation__move(buffer, moved, cell, below);
+    return;
+  }
+
+  bool has_left = col > 0;
+  bool has_right = col < width - 1;
+
+  bool left = has_left && cells[cell - 1] != GRID_CELL_EMPTY;
+  bool right = has_right && cells[cell + 1] != GRID_CELL_EMPTY;
+  bool left_below = has_left && cells[below - 1] != GRID_CELL_EMPTY;
+  bool right_below = has_right && cells[below + 1] != GRID_CELL_EMPTY;
+
+  if (pixel_type_to_material(PIXEL_TYPE_FIRE) == material) {
+
+    if (has_left && has_right) {
+      bool above = row > 0 && cells[cell - width] != GRID_CELL_EMPTY;
+
+      if (!left_below && left) {
+        dk_simulation__move(buffer, moved, cell, cell - 1);
+      } else if (!right_below && right) {
+        dk_simulation__move(buffer, moved, cell, cell + 1);
+      } else if (!above && row > 0) {
+        dk_simulation__move(buffer, moved, cell, cell - width);
+      } else if (!left) {
+        dk_simulation__move(buffer, moved, cell, cell - 1);
+      } else if (!right) {
+        dk_simulation__move(buffer, moved, cell, cell + 1);
+      }
+    }
+
+  } else if (pixel_type_to_material(PIXEL_TYPE_SAND) == material) {
+
+    if (has_left && has_right) {
+      if (!left_below && !left) {
+        dk_simulation__move(buffer, moved, cell, cell - 1);
+      } else if (!right_below && !right) {
+        dk_simulation__move(buffer, moved, cell, cell + 1);
+      }
+    } else if (has_right) {
+      if (!right_below && !right) {
+        dk_simulation__move(buffer, moved, cell, cell + 1);
+      }
+    }
+
+  } else if (pixel_type_to_material(PIXEL_TYPE_WATER) == material) {
+
+    if (has_left && has_right) {
+      if (!left) {
+        dk_simulation__move(buffer, moved, cell, cell - 1);
+      } else if (!right) {
+        dk_simulation__move(buffer, moved, cell, cell + 1);
+      }
+    } else if (has_right) {
+      if (!right) {
+        dk_simulation__move(buffer, moved, cell, cell + 1);
+      }
+    }
+  }
+}
+
+internal void
+dk_simulation__update_chunk(pixel_buffer_t* buffer, u32 chunk_col, u32 chunk_row)
+{
+  pixel_chunk_t* chunk = pixel_buffer_chunk(buffer, chunk_col, chunk_row);
+
+  // the bottom row never moves, everything else settles from the bottom up so
+  // a falling column moves as one piece
+  u32 first_row = chunk_row * GRID_CHUNK_SIZE;
+  u32 last_row = MIN(first_row + GRID_CHUNK_SIZE, buffer->height - 1);
+
+  for (u32 row = last_row; row-- > first_row;) {
+
+    // moves earlier in the chunk can grow the rect, so it is read again for
+    // every row and every column
+    if (row < chunk->dirty.min_row || row >= chunk->dirty.max_row) {
+      continue;
+    }
+
+    for (u32 col = chunk->dirty.min_col; col < chunk->dirty.max_col; col++) {
+      dk_simulation__update_cell(buffer, dk_simulation.moved, col, row);
+    }
+  }
+}
+
+// Awake chunks of one chunk column, bottom first. A chunk can be woken by the
+// one below it while the strip runs, so each is checked when its turn comes.
+internal void
+dk_simulation__update_strip(pixel_buffer_t* buffer, u32 chunk_col)
+{
+  for (u32 chunk_row = buffer->chunk_rows; chunk_row-- > 0;) {
+    if (!pixel_rect_is_empty(pixel_buffer_chunk(buffer, chunk_col, chunk_row)->dirty)) {
+      dk_simulation__update_chunk(buffer, chunk_col, chunk_row);
+    }
+  }
+}
+
+internal void
+dk_simulation__run_jobs(dk_simulation_pool_t* pool)
+{
+  for (;;) {
+    u32 job = (u32)SDL_AtomicAdd(&pool->next_job, 1);
+    if (job >= pool->job_count) {
+      break;
+    }
+
+    dk_simulation__update_strip(pool->buffer, pool->jobs[job]);
+  }
+}
+
+internal int
+dk_simulation__worker(void* data)
+{
+  dk_simulation_pool_t* pool = (dk_simulation_pool_t*)data;
+  for (;;) {
+    SDL_SemWait(pool->start);
+    if (pool->quit) {
+      break;
+    }
+    dk_simulation__run_jobs(pool);
+    SDL_SemPost(pool->done);
+  }
+  return 0;
+}
+
+internal void
+dk_simulation__stop_workers(dk_simulation_pool_t* pool)
+{
+  if (pool->threads == NULL) {
+    return;
+  }
+
+  pool->quit = true;
+  for (u32 i = 0; i < pool->thread_count - 1; i++) {
+    SDL_SemPost(pool->start);
+  }
+  for (u32 i = 0; i < pool->thread_count - 1; i++) {
+    SDL_WaitThread(pool->threads[i], NULL);
+  }
+
+  free(pool->threads);
+  SDL_DestroySemaphore(pool->start);
+  SDL_DestroySemaphore(pool->done);
+  pool->threads = NULL;
+  pool->quit = false;
+}
+
+internal void
+dk_simulation__start_workers(dk_simulation_pool_t* pool)
+{
+  if (pool->threads != NULL || pool->thread_count < 2) {
+    return;
+  }
+
+  pool->start = SDL_CreateSemaphore(0);
+  pool->done = SDL_CreateSemaphore(0);
+  pool->threads = (SDL_Thread**)malloc(sizeof(SDL_Thread*) * (pool->thread_count - 1));
+  for (u32 i = 0; i < pool->thread_count - 1; i++) {
+    pool->threads[i] = SDL_CreateThread(dk_simulation__worker, "dk_simulation", pool);
+  }
+}
+
+// 0 picks one thread per CPU core, 1 keeps the simulation on the calling
+// thread
+void
+dk_simulation_set_thread_count(u32 count)
+{
+  if (count == 0) {
+    count = (u32)MAX(SDL_GetCPUCount(), 1);
+  }
+
+  if (count != dk_simulation.pool.thread_count) {
+    dk_simulation__stop_workers(&dk_simulation.pool);
+    dk_simulation.pool.thread_count = count;
+  }
+}
+
+u32
+dk_simulation_get_thread_count(void)
+{
+  return MAX(dk_simulation.pool.thread_count, 1);
+}
+
+void
+dk_simulation_set_seed(u64 seed)
+{
+  dk_simulation.rng = dk_rng_create(seed);
+}
+
+void
+dk_simulation_destroy(void)
+{
+  dk_simulation__stop_workers(&dk_simulation.pool);
+  free(dk_simulation.pool.jobs);
+  free(dk_simulation.pool.awake);
+  free(dk_simulation.moved);
+  dk_simulation = (dk_simulation_t){ 0 };
+}
+
+// Scratch, stamp, dirty rects and random stream for the tick about to run on
+// a frame with cells.
+internal void
+dk_simulation__begin(pixel_buffer_t* buffer)
+{
+  dk_simulation_pool_t* pool = &dk_simulation.pool;
+
+  // scratch only grows, frames of different sizes share it
+  u32 cell_count = buffer->width * buffer->height;
+  if (dk_simulation.moved_capacity < cell_count) {
+    free(dk_simulation.moved);
+    dk_simulation.moved = (u8*)malloc(sizeof(u8) * cell_count);
+    dk_simulation.moved_capacity = cell_count;
+    dk_simulation.stamp = 0xff;
+  }
+
+  if (pool->job_capacity < buffer->chunk_cols) {
+    free(pool->jobs);
+    free(pool->awake);
+    pool->jobs = (u32*)malloc(sizeof(u32) * buffer->chunk_cols);
+    pool->awake = (u8*)malloc(sizeof(u8) * buffer->chunk_cols);
+    pool->job_capacity = buffer->chunk_cols;
+  }
+
+  // stamps are only cleared when they wrap, not every tick
+  if (++dk_simulation.stamp == 0) {
+    memset(dk_simulation.moved, 0, sizeof(u8) * dk_simulation.moved_capacity);
+    dk_simulation.stamp = 1;
+  }
+
+  memset(pool->awake, 0, sizeof(u8) * buffer->chunk_cols);
+  pixel_chunk_t* chunk = buffer->chunks;
+  for (u32 chunk_row = 0; chunk_row < buffer->chunk_rows; chunk_row++) {
+    for (u32 chunk_col = 0; chunk_col < buffer->chunk_cols; chunk_col++, chunk++) {
+      chunk->dirty = chunk->dirty_next;
+      chunk->dirty_next = PIXEL_RECT_EMPTY;
+      if (!pixel_rect_is_empty(chunk->dirty)) {
+        pool->awake[chunk_col] = 1;
+      }
+    }
+  }
+
+  dk_simulation.tick_rng = dk_rng_split(dk_simulation.rng, buffer->tick);
+}
+
+internal void
+dk_simulation__step(pixel_buffer_t* buffer, bool threaded)
+{
+  if (buffer->cells == NULL || buffer->count == 0) {
+    buffer->tick++;
+    return;
+  }
+
+  dk_simulation_pool_t* pool = &dk_simulation.pool;
+  dk_simulation__begin(buffer);
+
+  if (threaded) {
+    dk_simulation__start_workers(pool);
+  }
+  pool->buffer = buffer;
+
+  for (u32 phase = 0; phase < 2; phase++) {
+
+    // strips of this phase with an awake chunk. A strip can only be woken
+    // by the strips next to it, the odd ones by the even strips that ran in
+    // the first phase, and the chunks it finds asleep are skipped.
+    pool->job_count = 0;
+    for (u32 chunk_col = phase; chunk_col < buffer->chunk_cols; chunk_col += 2) {
+      bool woken = phase == 1 && (pool->awake[chunk_col - 1] ||
+                                  (chunk_col + 1 < buffer->chunk_cols && pool->awake[chunk_col + 1]));
+      if (pool->awake[chunk_col] || woken) {
+        pool->jobs[pool->job_count++] = chunk_col;
+      }
+    }
+
+    if (pool->job_count == 0) {
+      continue;
+    }
+
+    SDL_AtomicSet(&pool->next_job, 0);
+
+    // waking the workers is not worth it for a single chunk
+    u32 workers = threaded && pool->threads != NULL ? MIN(pool->thread_count - 1, pool->job_count - 1) : 0;
+    for (u32 i = 0; i < workers; i++) {
+      SDL_SemPost(pool->start);
+    }
+
+    dk_simulation__run_jobs(pool);
+
+    for (u32 i = 0; i < workers; i++) {
+      SDL_SemWait(pool->done);
+    }
+  }
+
+  buffer->tick++;
+}
+
+void
+dk_simulation_step(pixel_buffer_t* buffer)
+{
+  dk_simulation__step(buffer, true);
+}
+
+// Every chunk awake and a single thread, the same chunk order with nothing
+// skipped, which sleeping chunks and worker threads must reproduce exactly.
+void
+dk_simulation_step_reference(pixel_buffer_t* buffer)
+{
+  if (buffer->cells != NULL) {
+    pixel_buffer_wake_all(buffer);
+  }
+  dk_simulation__step(buffer, false);
+}
+
+// 64 bit fingerprint of the frame: size, and material and color of every
+// occupied cell. Each cell is hashed on its own and the results are summed,
+// so the hash does not depend on palette order and the loop has no
+// dependency chain.
+u64
+dk_simulation_hash(pixel_buffer_t* buffer)
+{
+  u64 hash = dk_hash_u64((u64)buffer->width << 32 | buffer->height);
+  if (buffer->cells == NULL) {
+    return hash;
+  }
+
+  u32 cell_count = buffer->width * buffer->height;
+  for (u32 base = 0; base < cell_count; base += 8) {
+
+    // empty space is skipped eight cells at a time
+    u64 word = 0;
+    memcpy(&word, buffer->cells + base, MIN(8, cell_count - base));
+    if (word == 0) {
+      continue;
+    }
+
+    for (u32 cell = base; cell < MIN(base + 8, cell_count); cell++) {
+      u8 material = buffer->cells[cell];
+      if (material == GRID_CELL_EMPTY) {
+        continue;
+      }
+
+      SDL_Color color = pixel_buffer_cell_color(buffer, cell);
+      u64 key = (u64)cell << 32 | (u64)color.r << 24 | (u64)color.g << 16 | (u64)color.b << 8 | color.a;
+      hash += dk_hash_u64(key + material * 0x9e3779b97f4a7c15ULL);
+    }
+  }
+
+  return hash;
+}
+
+void
+update_pixel_simulation(pixel_buffer_t* buffer)
+{
+  dk_simulation_step(buffer);
+}
+
+#endif // DK_SIMULATION_IMPLEMENTATION
+
+#endif // DK_SIMULATION_H
@@ -2,14 +2,57 @@
 #define DK_TEXT_H
 
 #include "dk.h"
+#include "dk_batch.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+// Printable ASCII is drawn from a glyph atlas, built once per font (and again
+// when its size changes). Anything else is rendered by SDL_ttf and kept in a
+// small LRU cache. The atlas also holds a white block, so solid quads can come
+// from the same texture as the glyphs and share their batch.
+#define DK_TEXT_GLYPH_FIRST 32
+#define DK_TEXT_GLYPH_LAST 126
+#define DK_TEXT_GLYPH_COUNT (DK_TEXT_GLYPH_LAST - DK_TEXT_GLYPH_FIRST + 1)
+#define DK_TEXT_ATLAS_COLUMNS 16
+
+#define DK_TEXT_CACHE_SIZE 16
+#define DK_TEXT_CACHE_TEXT 64 // longer strings are rendered every time
+
+typedef struct
+{
+  SDL_Rect rect; // in the atlas, drawn at the pen position
+  i32 advance;
+} dk_glyph_t;
+
+typedef struct
+{
+  u64 hash;
+  u32 used; // dk_text_t.cache_clock of the last hit, 0 when the slot is free
+  i32 width;
+  i32 height;
+  SDL_Color color;
+  SDL_Texture* texture; // NULL until the string is drawn, measuring is enough
+  char text[DK_TEXT_CACHE_TEXT];
+} dk_text_cache_entry_t;
+
 typedef struct
 {
   SDL_Renderer* renderer;
   TTF_Font* font;
   SDL_Color color;
+
+  // white glyphs, tinted by the vertex colors
+  SDL_Texture* atlas;
+  dk_glyph_t glyphs[DK_TEXT_GLYPH_COUNT];
+  SDL_Rect white; // one texel in the middle of the white block
+  s8 kerning[DK_TEXT_GLYPH_COUNT][DK_TEXT_GLYPH_COUNT];
+  i32 line_height;
+
+  dk_text_cache_entry_t cache[DK_TEXT_CACHE_SIZE];
+  u32 cache_clock;
+
+  // quads of the string being drawn by dk_text_draw_ext
+  dk_batch_t batch;
 } dk_text_t;
 
 void
@@ -36,7 +79,145 @@ dk_text_destroy(dk_text_t* draw_text);
 void
 dk_text_draw_ext(dk_text_t* draw_text, char* text, i32 x, i32 y, SDL_Color color);
 
+void
+dk_text_draw_batch(dk_text_t* draw_text, dk_batch_t* batch, char* text, i32 x, i32 y, SDL_Color color);
+
+void
+dk_text_fill_rect(dk_text_t* draw_text, dk_batch_t* batch, SDL_Rect rect, SDL_Color color);
+
 #if defined(DK_TEXT_IMPLEMENTATION)
+
+internal void
+dk_text__cache_clear(dk_text_t* draw_text)
+{
+  for (u32 i = 0; i < DK_TEXT_CACHE_SIZE; i++) {
+    if (draw_text->cache[i].texture != NULL) {
+      SDL_DestroyTexture(draw_text->cache[i].texture);
+    }
+  }
+  memset(draw_text->cache, 0, sizeof(draw_text->cache));
+  draw_text->cache_clock = 0;
+}
+
+// Renders every printable ASCII glyph once, in rows of DK_TEXT_ATLAS_COLUMNS
+// cells, followed by the white cell. Each glyph is rendered as a one character
+// string so it comes out where SDL_ttf would put it inside a longer one.
+internal void
+dk_text__build_atlas(dk_text_t* draw_text)
+{
+  if (draw_text->atlas != NULL) {
+    SDL_DestroyTexture(draw_text->atlas);
+    draw_text->atlas = NULL;
+  }
+
+  draw_text->line_height = TTF_FontHeight(draw_text->font);
+
+  SDL_Surface* surfaces[DK_TEXT_GLYPH_COUNT];
+  i32 cell_width = 1;
+  for (u32 i = 0; i < DK_TEXT_GLYPH_COUNT; i++) {
+    char text[2] = { (char)(DK_TEXT_GLYPH_FIRST + i), '\0' };
+    surfaces[i] = TTF_RenderText_Solid(draw_text->font, text, (SDL_Color){ 255, 255, 255, 255 });
+    if (surfaces[i] != NULL) {
+      cell_width = MAX(cell_width, surfaces[i]->w);
+    }
+
+    int advance = 0;
+    TTF_GlyphMetrics(draw_text->font, (Uint16)(DK_TEXT_GLYPH_FIRST + i), NULL, NULL, NULL, NULL, &advance);
+    draw_text->glyphs[i].advance = advance;
+
+    for (u32 j = 0; j < DK_TEXT_GLYPH_COUNT; j++) {
+      draw_text->kerning[i][j] = (s8)TTF_GetFontKerningSizeGlyphs(
+        draw_text->font, (Uint16)(DK_TEXT_GLYPH_FIRST + i), (Uint16)(DK_TEXT_GLYPH_FIRST + j));
+    }
+  }
+
+  // the white cell is at least 3x3 so filtering around its middle texel
+  // never picks up a glyph
+  cell_width = MAX(cell_width, 3);
+  i32 rows = (DK_TEXT_GLYPH_COUNT + 1 + DK_TEXT_ATLAS_COLUMNS - 1) / DK_TEXT_ATLAS_COLUMNS;
+  i32 cell_height = MAX(draw_text->line_height, 3);
+  SDL_Surface* atlas = SDL_CreateRGBSurfaceWithFormat(
+    0, cell_width * DK_TEXT_ATLAS_COLUMNS, cell_height * rows, 32, SDL_PIXELFORMAT_RGBA32);
+
+  for (u32 i = 0; i < DK_TEXT_GLYPH_COUNT; i++) {
+    SDL_Rect rect = {
+      (i32)(i % DK_TEXT_ATLAS_COLUMNS) * cell_width,
+      (i32)(i / DK_TEXT_ATLAS_COLUMNS) * cell_height,
+      0,
+      0,
+    };
+    if (surfaces[i] != NULL) {
+      rect.w = MIN(surfaces[i]->w, cell_width);
+      rect.h = MIN(surfaces[i]->h, cell_height);
+      SDL_BlitSurface(surfaces[i], NULL, atlas, &rect);
+      SDL_FreeSurface(surfaces[i]);
+    }
+    draw_text->glyphs[i].rect = rect;
+  }
+
+  SDL_Rect white = {
+    (i32)(DK_TEXT_GLYPH_COUNT % DK_TEXT_ATLAS_COLUMNS) * cell_width,
+    (i32)(DK_TEXT_GLYPH_COUNT / DK_TEXT_ATLAS_COLUMNS) * cell_height,
+    cell_width,
+    cell_height,
+  };
+  SDL_FillRect(atlas, &white, SDL_MapRGBA(atlas->format, 255, 255, 255, 255));
+  draw_text->white = (SDL_Rect){ white.x + cell_width / 2, white.y + cell_height / 2, 1, 1 };
+
+  draw_text->atlas = SDL_CreateTextureFromSurface(draw_text->renderer, atlas);
+  SDL_SetTextureBlendMode(draw_text->atlas, SDL_BLENDMODE_BLEND);
+  SDL_FreeSurface(atlas);
+}
+
+internal bool
+dk_text__in_atlas(char* text)
+{
+  for (char* c = text; *c != '\0'; c++) {
+    if ((u8)*c < DK_TEXT_GLYPH_FIRST || (u8)*c > DK_TEXT_GLYPH_LAST) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Cache slot of a string, measured on a miss. NULL for strings too long to
+// keep, the least recently used slot is given up for new ones.
+internal dk_text_cache_entry_t*
+dk_text__cache_get(dk_text_t* draw_text, char* text)
+{
+  size_t length = strlen(text);
+  if (length >= DK_TEXT_CACHE_TEXT) {
+    return NULL;
+  }
+
+  u64 hash = dk_hash_u64(length);
+  for (size_t i = 0; i < length; i++) {
+    hash = dk_hash_u64(hash ^ (u8)text[i]);
+  }
+
+  dk_text_cache_entry_t* oldest = &draw_text->cache[0];
+  for (u32 i = 0; i < DK_TEXT_CACHE_SIZE; i++) {
+    dk_text_cache_entry_t* entry = &draw_text->cache[i];
+    if (entry->used != 0 && entry->hash == hash && strcmp(entry->text, text) == 0) {
+      entry->used = ++draw_text->cache_clock;
+      return entry;
+    }
+    if (entry->used < oldest->used) {
+      oldest = entry;
+    }
+  }
+
+  if (oldest->texture != NULL) {
+    SDL_DestroyTexture(oldest->texture);
+    oldest->texture = NULL;
+  }
+  oldest->hash = hash;
+  oldest->used = ++draw_text->cache_clock;
+  memcpy(oldest->text, text, length + 1);
+  TTF_SizeText(draw_text->font, text, &oldest->width, &oldest->height);
+  return oldest;
+}
+
 void
 dk_text_init(dk_text_t* draw_text,
              SDL_Renderer* renderer,
@@ -46,6 +227,11 @@ dk_text_init(dk_text_t* draw_text,
   draw_text->renderer = renderer;
   draw_text->font = font;
   draw_text->color = color;
+  draw_text->atlas = NULL;
+  memset(draw_text->cache, 0, sizeof(draw_text->cache));
+  draw_text->cache_clock = 0;
+  dk_batch_init(&draw_text->batch, renderer);
+  dk_text__build_atlas(draw_text);
 }
 
 char*
@@ -58,6 +244,8 @@ dk_text_itoa(u32 number)
 
 void dk_text_set_size(dk_text_t *fptr, i32 size) {
   TTF_SetFontSize(fptr->font, size);
+  dk_text__cache_clear(fptr);
+  dk_text__build_atlas(fptr);
 }
 
 void
@@ -66,36 +254,144 @@ dk_text_draw(dk_text_t* draw_text, char* text, i32 x, i32 y)
   dk_text_draw_ext(draw_text, text, x, y, draw_text->color);
 }
 
-void
-dk_text_draw_ext(dk_text_t* draw_text, char* text, i32 x, i32 y, SDL_Color color)
+// strings the atlas cannot draw, the texture is cached per string and color
+internal void
+dk_text__draw_rendered(dk_text_t* draw_text, char* text, i32 x, i32 y, SDL_Color color)
 {
+  dk_text_cache_entry_t* entry = dk_text__cache_get(draw_text, text);
+  bool same_color = entry != NULL && entry->color.r == color.r && entry->color.g == color.g &&
+                    entry->color.b == color.b && entry->color.a == color.a;
+
+  if (entry != NULL && entry->texture != NULL && same_color) {
+    SDL_Rect rect = { x, y, entry->width, entry->height };
+    SDL_RenderCopy(draw_text->renderer, entry->texture, NULL, &rect);
+    return;
+  }
+
   SDL_Surface* surface = TTF_RenderText_Solid(draw_text->font, text, color);
+  if (surface == NULL) {
+    return;
+  }
   SDL_Texture* texture = SDL_CreateTextureFromSurface(draw_text->renderer, surface);
   SDL_Rect rect = { x, y, surface->w, surface->h };
   SDL_RenderCopy(draw_text->renderer, texture, NULL, &rect);
+
+  if (entry != NULL) {
+    if (entry->texture != NULL) {
+      SDL_DestroyTexture(entry->texture);
+    }
+    entry->texture = texture;
+    entry->color = color;
+    entry->width = surface->w;
+    entry->height = surface->h;
+  } else {
+    SDL_DestroyTexture(texture);
+  }
   SDL_FreeSurface(surface);
-  SDL_DestroyTexture(texture);
+}
+
+void
+dk_text_draw_ext(dk_text_t* draw_text, char* text, i32 x, i32 y, SDL_Color color)
+{
+  dk_text_draw_batch(draw_text, &draw_text->batch, text, x, y, color);
+  dk_batch_flush(&draw_text->batch);
+}
+
+// Records one quad per visible glyph in `batch`, to be drawn with whatever
+// else it holds. Strings the atlas cannot draw go straight to the renderer
+// after the quads waiting in `batch`, their texture may not outlive the cache.
+void
+dk_text_draw_batch(dk_text_t* draw_text, dk_batch_t* batch, char* text, i32 x, i32 y, SDL_Color color)
+{
+  if (draw_text->atlas == NULL || !dk_text__in_atlas(text)) {
+    dk_batch_flush(batch);
+    dk_text__draw_rendered(draw_text, text, x, y, color);
+    return;
+  }
+
+  i32 pen = x;
+  for (u32 i = 0; text[i] != '\0'; i++) {
+    u32 glyph_index = (u8)text[i] - DK_TEXT_GLYPH_FIRST;
+    if (i > 0) {
+      pen += draw_text->kerning[(u8)text[i - 1] - DK_TEXT_GLYPH_FIRST][glyph_index];
+    }
+
+    dk_glyph_t* glyph = &draw_text->glyphs[glyph_index];
+    if (text[i] != ' ' && glyph->rect.w > 0) {
+      SDL_Rect rect = { pen, y, glyph->rect.w, glyph->rect.h };
+      dk_batch_image(batch, draw_text->atlas, glyph->rect, rect, color);
+    }
+
+    pen += glyph->advance;
+  }
+}
+
+// solid quad from the white block, batches with the glyphs around it
+void
+dk_text_fill_rect(dk_text_t* draw_text, dk_batch_t* batch, SDL_Rect rect, SDL_Color color)
+{
+  if (draw_text->atlas == NULL) {
+    dk_batch_rect(batch, rect, color);
+    return;
+  }
+  dk_batch_image(batch, draw_text->atlas, draw_text->white, rect, color);
 }
 
 int
 dk_text_width(dk_text_t* draw_text, char* text)
 {
-  int w;
-  TTF_SizeText(draw_text->font, text, &w, NULL);
-  return w;
+  if (draw_text->atlas == NULL || !dk_text__in_atlas(text)) {
+    dk_text_cache_entry_t* entry = dk_text__cache_get(draw_text, text);
+    if (entry != NULL) {
+      return entry->width;
+    }
+    int w;
+    TTF_SizeText(draw_text->font, text, &w, NULL);
+    return w;
+  }
+
+  // pen advance of the last glyph, or the right edge of its pixels when they
+  // stick out further, the way SDL_ttf sizes a string
+  i32 pen = 0;
+  i32 width = 0;
+  for (u32 i = 0; text[i] != '\0'; i++) {
+    u32 glyph_index = (u8)text[i] - DK_TEXT_GLYPH_FIRST;
+    if (i > 0) {
+      pen += draw_text->kerning[(u8)text[i - 1] - DK_TEXT_GLYPH_FIRST][glyph_index];
+    }
+    dk_glyph_t* glyph = &draw_text->glyphs[glyph_index];
+    width = MAX(width, pen + MAX(glyph->advance, glyph->rect.w));
+    pen += glyph->advance;
+  }
+  return width;
 }
 
 int
 dk_text_height(dk_text_t* draw_text, char* text)
 {
-  int h;
-  TTF_SizeText(draw_text->font, text, NULL, &h);
-  return h;
+  if (draw_text->atlas == NULL || !dk_text__in_atlas(text)) {
+    dk_text_cache_entry_t* entry = dk_text__cache_get(draw_text, text);
+    if (entry != NULL) {
+      return entry->height;
+    }
+    int h;
+    TTF_SizeText(draw_text->font, text, NULL, &h);
+    return h;
+  }
+
+  // every line is as high as the font
+  return draw_text->line_height;
 }
 
 void
 dk_text_destroy(dk_text_t* draw_text)
 {
+  dk_text__cache_clear(draw_text);
+  if (draw_text->atlas != NULL) {
+    SDL_DestroyTexture(draw_text->atlas);
+    draw_text->atlas = NULL;
+  }
+  dk_batch_destroy(&draw_text->batch);
   TTF_CloseFont(draw_text->font);
 }
 
@@ -8,11 +8,22 @@
 #include "dk_text.h"
 #include "dk_app.h"
 
+// Widgets test the mouse right away but only record what they look like in
+// game->ui_batch, the frame's draw list. Solid quads and glyphs come from the
+// ui_text atlas and icons from the tileset, the list is drawn in the order it
+// was recorded with one call per run of quads sharing a texture when the
+// frame is flushed at the end of game_render.
+void
+dk_ui_rect(app_t* game, SDL_Rect rect, SDL_Color color);
+
+void
+dk_ui_text(app_t* game, char* text, i32 x, i32 y);
+
 bool
 dk_ui_button(app_t* game, SDL_Rect rect, SDL_Color color, char* text, bool* focused);
 
 bool
-dk_ui_icon_button(app_t* game, SDL_Rect rect, SDL_Color color, SDL_Texture* texture, bool* focused);
+dk_ui_icon_button(app_t* game, SDL_Rect rect, SDL_Color color, icon_t* icon, bool* focused);
 
 void
 dk_ui_text_input(app_t* game, SDL_Point position, char* placeholder, void(callback)(char*), bool* focused);
@@ -22,6 +33,19 @@ dk_ui_tooltip(app_t* game, SDL_Rect rect, char* text, bool* visible);
 
 #if defined(DK_UI_IMPLEMENTATION)
 
+void
+dk_ui_rect(app_t* game, SDL_Rect rect, SDL_Color color)
+{
+  dk_text_fill_rect(&game->ui_text, &game->ui_batch, rect, color);
+}
+
+// in game->ui_text.color, like dk_text_draw
+void
+dk_ui_text(app_t* game, char* text, i32 x, i32 y)
+{
+  dk_text_draw_batch(&game->ui_text, &game->ui_batch, text, x, y, game->ui_text.color);
+}
+
 void
 dk_ui_tooltip(app_t* game, SDL_Rect rect, char* text, bool* visible)
 {
@@ -44,8 +68,7 @@ dk_ui_tooltip(app_t* game, SDL_Rect rect, char* text, bool* visible)
       text_height + 10
     };
 
-    SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
-    SDL_RenderFillRect(game->renderer, &tooltip_rect);
+    dk_ui_rect(game, tooltip_rect, C64_BLACK);
 
     SDL_Point position = {
       tooltip_rect.x + tooltip_rect.w / 2 - dk_text_width(&game->ui_text, text) / 2,
@@ -53,7 +76,7 @@ dk_ui_tooltip(app_t* game, SDL_Rect rect, char* text, bool* visible)
     };
 
     game->ui_text.color = C64_WHITE;
-    dk_text_draw(&game->ui_text, text, position.x, position.y);
+    dk_ui_text(game, text, position.x, position.y);
   }
 }
 
@@ -101,8 +124,7 @@ dk_ui_button(app_t* game, SDL_Rect rect, SDL_Color color, char* text, bool* focu
     *focused = false;
   }
 
-  SDL_SetRenderDrawColor(game->renderer, btn_color.r, btn_color.g, btn_color.b, btn_color.a);
-  SDL_RenderFillRect(game->renderer, &rect);
+  dk_ui_rect(game, rect, btn_color);
 
   SDL_Point position = {
     rect.x + rect.w / 2 - dk_text_width(&game->ui_text, text) / 2,
@@ -116,7 +138,7 @@ dk_ui_button(app_t* game, SDL_Rect rect, SDL_Color color, char* text, bool* focu
   }
 
   game->ui_text.color = text_color;
-  dk_text_draw(&game->ui_text, text, position.x, position.y);
+  dk_ui_text(game, text, position.x, position.y);
 
   if (mouse_pressed) {
     return true;
@@ -125,7 +147,7 @@ dk_ui_button(app_t* game, SDL_Rect rect, SDL_Color color, char* text, bool* focu
   return false;
 }
 
-bool dk_ui_icon_button(app_t* game, SDL_Rect rect, SDL_Color color, SDL_Texture* texture, bool* focused)
+bool dk_ui_icon_button(app_t* game, SDL_Rect rect, SDL_Color color, icon_t* icon, bool* focused)
 {
 
   SDL_Color btn_color = color;
@@ -162,8 +184,9 @@ bool dk_ui_icon_button(app_t* game, SDL_Rect rect, SDL_Color color, SDL_Texture*
     rect.h
   };
 
-  SDL_SetTextureColorMod(texture, btn_color.r, btn_color.g, btn_color.b);
-  SDL_RenderCopy(game->renderer, texture, NULL, &image_rect);
+  // tinted like SDL_SetTextureColorMod did, the alpha stays opaque
+  btn_color.a = 255;
+  dk_batch_image(&game->ui_batch, icon->texture, icon->source, image_rect, btn_color);
 
   if (mouse_pressed) {
     return true;
@@ -180,7 +203,6 @@ void dk_ui_text_input(app_t* game, SDL_Point position, char* placeholder, void(c
   int text_height = dk_text_height(&game->ui_text, text);
 
   SDL_Color color = C64_YELLOW;
-  SDL_SetRenderDrawColor(game->renderer, color.r, color.g, color.b, color.a);
 
   SDL_Rect rect = { position.x, position.y, 200, 40 };
 
@@ -198,18 +220,17 @@ void dk_ui_text_input(app_t* game, SDL_Point position, char* placeholder, void(c
     *focused = false;
   }
 
-  SDL_RenderFillRect(game->renderer, &rect);
+  dk_ui_rect(game, rect, color);
 
   const int text_margin = 5;
   if (strlen(text) == 0) {
-    dk_text_draw(&game->ui_text, placeholder, position.x + text_margin, position.y);
+    dk_ui_text(game, placeholder, position.x + text_margin, position.y);
   } else {
-    dk_text_draw(&game->ui_text, text, position.x + text_margin, position.y);
+    dk_ui_text(game, text, position.x + text_margin, position.y);
   }
 
   // Unerline Curso
-  SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
-  SDL_RenderFillRect(game->renderer, &(SDL_Rect){ position.x + text_width + text_margin, position.y + text_height, 10, 5 });
+  dk_ui_rect(game, (SDL_Rect){ position.x + text_width + text_margin, position.y + text_height, 10, 5 }, C64_BLACK);
 
   static int number_of_keys = 0;
   if (SDL_GetKeyboardState(&number_of_keys)[SDL_SCANCODE_RETURN]) {
@@ -0,0 +1,184 @@
+#if !defined(DK_WORKER_H)
+#define DK_WORKER_H
+
+#include <SDL2/SDL.h>
+
+#include "dk.h"
+
+// background worker
+//
+// One thread that runs slow jobs (saving, exporting, importing) away from the
+// main loop, one after the other in the order they were pushed. A job works
+// on data of its own and never on anything the main thread keeps using, when
+// it is done its `done` callback runs back on the main thread from
+// dk_worker_poll. `notify` is called on the worker after every job so a main
+// loop waiting for events can wake up and poll (see app_wake).
+typedef void (*dk_worker_fn)(void* data);
+
+typedef struct dk_worker_job_t
+{
+  dk_worker_fn run;  // on the worker thread
+  dk_worker_fn done; // on the main thread, may be NULL
+  void* data;
+  struct dk_worker_job_t* next;
+} dk_worker_job_t;
+
+typedef struct
+{
+  SDL_Thread* thread; // started by the first push
+  SDL_mutex* lock;
+  SDL_cond* wake;
+  // first in, first out lists guarded by `lock`
+  dk_worker_job_t* queued;
+  dk_worker_job_t* queued_last;
+  dk_worker_job_t* finished;
+  dk_worker_job_t* finished_last;
+  // pushed and not polled yet, only touched by the main thread
+  u32 pending;
+  bool quit;
+  void (*notify)(void);
+} dk_worker_t;
+
+void
+dk_worker_init(dk_worker_t* worker, void (*notify)(void));
+
+void
+dk_worker_push(dk_worker_t* worker, dk_worker_fn run, dk_worker_fn done, void* data);
+
+u32
+dk_worker_poll(dk_worker_t* worker);
+
+void
+dk_worker_destroy(dk_worker_t* worker);
+
+#if defined(DK_WORKER_IMPLEMENTATION)
+
+void
+dk_worker_init(dk_worker_t* worker, void (*notify)(void))
+{
+  worker->thread = NULL;
+  worker->lock = NULL;
+  worker->wake = NULL;
+  worker->queued = NULL;
+  worker->queued_last = NULL;
+  worker->finished = NULL;
+  worker->finished_last = NULL;
+  worker->pending = 0;
+  worker->quit = false;
+  worker->notify = notify;
+}
+
+// Runs jobs until told to quit, the ones still queued by then are run first
+// so nothing pushed before dk_worker_destroy is lost.
+internal int
+dk_worker__run(void* data)
+{
+  dk_worker_t* worker = (dk_worker_t*)data;
+  SDL_LockMutex(worker->lock);
+  for (;;) {
+    while (worker->queued == NULL && !worker->quit) {
+      SDL_CondWait(worker->wake, worker->lock);
+    }
+    if (worker->queued == NULL) {
+      break;
+    }
+
+    dk_worker_job_t* job = worker->queued;
+    worker->queued = job->next;
+    if (worker->queued == NULL) {
+      worker->queued_last = NULL;
+    }
+
+    SDL_UnlockMutex(worker->lock);
+    job->run(job->data);
+    SDL_LockMutex(worker->lock);
+
+    job->next = NULL;
+    if (worker->finished_last != NULL) {
+      worker->finished_last->next = job;
+    } else {
+      worker->finished = job;
+    }
+    worker->finished_last = job;
+
+    if (worker->notify != NULL) {
+      worker->notify();
+    }
+  }
+  SDL_UnlockMutex(worker->lock);
+  return 0;
+}
+
+void
+dk_worker_push(dk_worker_t* worker, dk_worker_fn run, dk_worker_fn done, void* data)
+{
+  if (worker->thread == NULL) {
+    worker->lock = SDL_CreateMutex();
+    worker->wake = SDL_CreateCond();
+    worker->thread = SDL_CreateThread(dk_worker__run, "dk_worker", worker);
+  }
+
+  dk_worker_job_t* job = (dk_worker_job_t*)malloc(sizeof(dk_worker_job_t));
+  *job = (dk_worker_job_t){ run, done, data, NULL };
+
+  SDL_LockMutex(worker->lock);
+  if (worker->queued_last != NULL) {
+    worker->queued_last->next = job;
+  } else {
+    worker->queued = job;
+  }
+  worker->queued_last = job;
+  SDL_CondSignal(worker->wake);
+  SDL_UnlockMutex(worker->lock);
+
+  worker->pending++;
+}
+
+// Calls `done` for every job that finished since the last poll, in the order
+// they were pushed. Returns how many jobs are still queued or running.
+u32
+dk_worker_poll(dk_worker_t* worker)
+{
+  if (worker->pending == 0) {
+    return 0;
+  }
+
+  SDL_LockMutex(worker->lock);
+  dk_worker_job_t* job = worker->finished;
+  worker->finished = NULL;
+  worker->finished_last = NULL;
+  SDL_UnlockMutex(worker->lock);
+
+  while (job != NULL) {
+    dk_worker_job_t* next = job->next;
+    if (job->done != NULL) {
+      job->done(job->data);
+    }
+    free(job);
+    worker->pending--;
+    job = next;
+  }
+  return worker->pending;
+}
+
+// Waits for every job pushed so far, runs their `done` callbacks and stops
+// the thread.
+void
+dk_worker_destroy(dk_worker_t* worker)
+{
+  if (worker->thread != NULL) {
+    SDL_LockMutex(worker->lock);
+    worker->quit = true;
+    SDL_CondSignal(worker->wake);
+    SDL_UnlockMutex(worker->lock);
+    SDL_WaitThread(worker->thread, NULL);
+
+    dk_worker_poll(worker);
+    SDL_DestroyCond(worker->wake);
+    SDL_DestroyMutex(worker->lock);
+  }
+  dk_worker_init(worker, worker->notify);
+}
+
+#endif // DK_WORKER_IMPLEMENTATION
+#endif // DK_WORKER_H
@@ -18,6 +18,9 @@
 #include <unistd.h>
 #include <string.h>
 
+#define DK_BATCH_IMPLEMENTATION
+#include "dk_batch.h"
+
 #define DK_TEXT_IMPLEMENTATION
 #include "dk_text.h"
 
@@ -27,6 +30,9 @@
 #define DK_PIXELBUFFER_IMPLEMENTATION
 #include "dk_pixelbuffer.h"
 
+#define DK_SIMULATION_IMPLEMENTATION
+#include "dk_simulation.h"
+
 #include "dk_app.h"
 #include "dk_macros.h"
 
@@ -39,11 +45,18 @@
 #define DK_CLIPBOARD_IMPLEMENTATION
 #include "dk_clipboard.h"
 
+#define DK_CANVAS_IMPLEMENTATION
+#include "dk_canvas.h"
+
+#define DK_WORKER_IMPLEMENTATION
+#include "dk_worker.h"
+
 typedef enum {
   BRUSH_RECT = 0,
   BRUSH_CIRCLE,
   BRUSH_LINE,
   BRUSH_RECT_OUTLINE,
+  BRUSH_FILL,
   BRUSH_COUNT,
   BRUSH_ERASER,
   BRUSH_PENCIL,
@@ -72,13 +85,45 @@ pixel_type_t primary_pixel_type = PIXEL_TYPE_WATER;
 
 BrushType primary_brush_type = BRUSH_CIRCLE;
 i32 primary_brush_size = 2;
+// what BRUSH_FILL spreads over, F switches
+pixel_fill_mode_t primary_fill_mode = PIXEL_FILL_COLOR;
+// colors of dropped images, exact or the C64 palette, Q switches
+pixel_import_mode_t import_mode = PIXEL_IMPORT_EXACT;
 
 static const int frame_count = 9;
 pixel_buffer_t* frames;
+// grids of every frame, one allocation for all of them
+dk_memory_arena_t* frame_arena = NULL;
 int active_frame_buffer_index = 0;
 
+// size of new frames, --size WxH
+u32 frame_width = GRID_WIDTH;
+u32 frame_height = GRID_HEIGHT;
+
 dk_clipboard_t* clipboard = NULL;
 
+// texture of the active frame
+dk_canvas_t canvas;
+
+// saves, exports and dropped files run here, the UI keeps going while a
+// file is written or read
+static dk_worker_t worker;
+// what the last save or import is up to, shown in the bottom panel until
+// file_status_until
+static char file_status[300] = { 0 };
+static u32 file_status_until = 0;
+
+// Cell the brush was last put down at while the button stays held, strokes
+// pick up from there in the next frame.
+static bool stroke_active = false;
+static i32 stroke_col = 0;
+static i32 stroke_row = 0;
+// what the stroke covers this frame, reused from frame to frame
+static pixel_spans_t stroke_spans = { 0 };
+// the fill brush ran for the click in progress, only releasing the button
+// clears it, leaving the canvas does not
+static bool fill_done = false;
+
 void
 game_init(app_t* game)
 {
@@ -97,7 +142,7 @@ game_init(app_t* game)
 
   game->stats = (app_stats_t) {0};
   game->mouse = (app_mouse_t) {0};
-  game->camera = (app_camera_t) {0};
+  game->camera = (app_camera_t) { .zoom = GRID_CELL_SIZE };
   game->ui_focused = false;
 
   if (SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -132,7 +177,13 @@ game_init(app_t* game)
 
   SDL_SetRenderDrawBlendMode(game->renderer, SDL_BLENDMODE_BLEND);
 
+  SDL_RendererInfo renderer_info;
+  game->vsync = SDL_GetRendererInfo(game->renderer, &renderer_info) == 0 &&
+                (renderer_info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+  game->redraw_frames = 2;
+
   load_tileset(game->renderer, tileset, "assets/icons/tileset.png");
+  dk_batch_init(&game->ui_batch, game->renderer);
 
   get_icon_from_tileset(game->renderer, tileset, &icons[ICON_GRID], (SDL_Point){7, 2});
   get_icon_from_tileset(game->renderer, tileset, &icons[ICON_CLEAR], (SDL_Point){9, 8});
@@ -188,40 +239,190 @@ game_init(app_t* game)
 
   dk_text_init(&game->ui_text, game->renderer, ui_font, (SDL_Color){ 0, 0, 0, 255 });
 
-  frames = (pixel_buffer_t*) malloc(sizeof(pixel_buffer_t) * frame_count);
+  // room for every frame at its starting size, a frame that grows later (a
+  // bigger file dropped on it) takes a new block from the same arena
+  u32 chunk_count = ((frame_width + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE) *
+                    ((frame_height + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE);
+  assert(frame_count > 0);
+  sz_t frame_slots = (sz_t)frame_count;
+  sz_t frame_bytes = (sz_t)2 * frame_width * frame_height + sizeof(pixel_chunk_t) * chunk_count;
+  frame_arena = dk_memory_arena_create(frame_slots * (frame_bytes + 2 * DK_MEMORY_ARENA_ALIGN));
+
+  frames = (pixel_buffer_t*) malloc(sizeof(pixel_buffer_t) * frame_slots);
   for (int i = 0; i < frame_count; i++) {
-    pixel_buffer_init(&frames[i]);
+    pixel_buffer_init_arena(&frames[i], frame_arena, frame_width, frame_height);
   }
 
   clipboard = (pixel_buffer_t*) malloc(sizeof(pixel_buffer_t));
-  memset(clipboard, 0, sizeof(pixel_buffer_t));
+  pixel_buffer_init(clipboard);
+
+  dk_canvas_init(&canvas, game->renderer);
+  dk_worker_init(&worker, app_wake);
 
   game->running = true;
 }
 
+// a file dropped on a frame, read on the worker, see game__import
+typedef struct
+{
+  pixel_buffer_t frame;
+  char* filename; // from the drop event
+  int target;     // index in frames
+  pixel_import_mode_t mode;
+  bool loaded;
+} game_import_t;
+
+internal void
+game__import_run(void* data)
+{
+  game_import_t* import = (game_import_t*)data;
+  const char* extension = strrchr(import->filename, '.');
+  if (extension != NULL && strcmp(extension, ".png") == 0) {
+    import->loaded = png_to_pixel_buffer(&import->frame, import->filename, 1, import->mode);
+  } else {
+    import->loaded = pixel_buffer_load(&import->frame, import->filename);
+  }
+}
+
+// Puts the frame that was read in place of the one it was dropped on, a
+// struct swap. The grids it replaces go back to the heap, or stay with
+// frame_arena until the game ends when they came from there.
+internal void
+game__import_done(void* data)
+{
+  game_import_t* import = (game_import_t*)data;
+  if (import->loaded) {
+    pixel_buffer_t replaced = frames[import->target];
+    frames[import->target] = import->frame;
+    pixel_buffer_destroy(&replaced);
+    snprintf(file_status, sizeof(file_status), "Loaded %s", import->filename);
+  } else {
+    pixel_buffer_destroy(&import->frame);
+    snprintf(file_status, sizeof(file_status), "Unable to load %s", import->filename);
+  }
+  file_status_until = SDL_GetTicks() + 3000;
+
+  SDL_free(import->filename);
+  free(import);
+}
+
+// Reads a dropped .psb or .png on the worker into a frame of its own, which
+// replaces the active frame once it is complete. Until then the frame stays
+// as it is and can be painted and simulated, changes made meanwhile are lost
+// with it. Takes the filename of the drop event.
+internal void
+game__import(char* filename)
+{
+  game_import_t* import = (game_import_t*)malloc(sizeof(game_import_t));
+  import->filename = filename;
+  import->target = active_frame_buffer_index;
+  import->mode = import_mode;
+  import->loaded = false;
+  pixel_buffer_init_size(&import->frame, 1, 1);
+
+  snprintf(file_status, sizeof(file_status), "Loading %s", filename);
+  file_status_until = UINT32_MAX;
+  dk_worker_push(&worker, game__import_run, game__import_done, import);
+}
+
 void
 game_destroy(app_t* game)
 {
+  // saves still being written are finished first, quitting right after
+  // asking for one does not lose it
+  dk_worker_destroy(&worker);
+  dk_simulation_destroy();
+  pixel_buffer_destroy(clipboard);
+  free(clipboard);
+  // frames that were replaced by a dropped file have their grids on the heap
+  for (int i = 0; i < frame_count; i++) {
+    pixel_buffer_destroy(&frames[i]);
+  }
+  free(frames);
+  dk_memory_arena_free(frame_arena);
+  dk_canvas_destroy(&canvas);
+  pixel_spans_free(&stroke_spans);
   dk_text_destroy(&game->text);
+  dk_text_destroy(&game->ui_text);
+  dk_batch_destroy(&game->ui_batch);
   SDL_DestroyRenderer(game->renderer);
   SDL_DestroyWindow(game->window);
   TTF_Quit();
   SDL_Quit();
 }
 
+// Wakes the main loop from an idle wait, from any thread. The event carries
+// nothing, receiving it is what schedules the redraw.
+void
+app_wake(void)
+{
+  SDL_Event event = { 0 };
+  event.type = SDL_USEREVENT;
+  SDL_PushEvent(&event);
+}
+
+// Keeps a position the cursor passed while painting. When more come in than
+// a frame can hold the newest replaces the last one, the stroke then cuts
+// straight across to it.
+void
+app_stroke_add(app_t* game, i32 x, i32 y)
+{
+  app_stroke_t* stroke = &game->stroke;
+  u32 index = MIN(stroke->count, APP_STROKE_SAMPLES - 1);
+  stroke->samples[index] = (app_stroke_sample_t){ x, y };
+  stroke->count = index + 1;
+}
+
+// Something on screen changes without a new event: the simulation is
+// running, or a held key or button keeps panning, zooming or painting.
+bool
+game_is_animating(app_t* game)
+{
+  if (game->state == IN_GAME && game->game_state.simulation_running) {
+    return true;
+  }
+
+  if (SDL_GetMouseState(NULL, NULL) != 0) {
+    return true;
+  }
+
+  int key_count = 0;
+  const Uint8* keys = SDL_GetKeyboardState(&key_count);
+  for (int i = 0; i < key_count; i++) {
+    if (keys[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void
 game_handle_events(app_t* game)
 {
   while (SDL_PollEvent(&game->event)) {
+    // the UI reacts while it is drawn, so a change made by this event shows
+    // up one frame later, draw both
+    game->redraw_frames = 2;
+
     switch (game->event.type) {
       case (SDL_DROPFILE): {
         if (game->state == IN_GAME) {
-          char* dropped_filedir = game->event.drop.file;
-          pixel_buffer_load(&frames[active_frame_buffer_index], dropped_filedir);
-          free(dropped_filedir);
+          game__import(game->event.drop.file);
+        } else {
+          SDL_free(game->event.drop.file);
         }
       }
         break;
+      case SDL_MOUSEBUTTONDOWN:
+        if (game->event.button.button == SDL_BUTTON_LEFT) {
+          app_stroke_add(game, game->event.button.x, game->event.button.y);
+        }
+        break;
+      case SDL_MOUSEMOTION:
+        if (game->event.motion.state & SDL_BUTTON_LMASK) {
+          app_stroke_add(game, game->event.motion.x, game->event.motion.y);
+        }
+        break;
       case SDL_MOUSEWHEEL:
         if (game->event.wheel.y > 0) {
           if (primary_brush_size < 100) {
@@ -277,6 +478,19 @@ game_handle_events(app_t* game)
           case SDLK_9:
             active_frame_buffer_index = 8;
             break;
+          // picks the fill brush, pressed again switches between filling
+          // by color and by material
+          case SDLK_f:
+            if (primary_brush_type == BRUSH_FILL) {
+              primary_fill_mode = primary_fill_mode == PIXEL_FILL_COLOR ? PIXEL_FILL_MATERIAL : PIXEL_FILL_COLOR;
+            }
+            primary_brush_type = BRUSH_FILL;
+            break;
+          case SDLK_q:
+            import_mode = import_mode == PIXEL_IMPORT_EXACT ? PIXEL_IMPORT_C64 : PIXEL_IMPORT_EXACT;
+            snprintf(file_status, sizeof(file_status), "Images import with %s", import_mode == PIXEL_IMPORT_C64 ? "the C64 palette" : "their own colors");
+            file_status_until = SDL_GetTicks() + 3000;
+            break;
         }
         break;
     }
@@ -285,21 +499,181 @@ game_handle_events(app_t* game)
 
 int coord_x, coord_y = 0;
 
+// on screen size of the active frame, frames can differ in size
+i32 canvas_width(void)
+{
+  return (i32)frames[active_frame_buffer_index].width * pixel_size;
+}
+
+i32 canvas_height(void)
+{
+  return (i32)frames[active_frame_buffer_index].height * pixel_size;
+}
+
 i32 posToGridWithOffsetX(i32 x)
 {
-  i32 _x = (x - (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2) / pixel_size;
+  i32 _x = (x - (WINDOW_WIDTH - canvas_width()) / 2) / pixel_size;
   return _x;
 }
 
 i32 posToGridWithOffsetY(i32 y)
 {
-  i32 _y = (y - (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2) / pixel_size;
+  i32 _y = (y - (WINDOW_HEIGHT - canvas_height()) / 2) / pixel_size;
   return _y;
 }
 
+internal void
+game__stroke_brush(i32 col, i32 row)
+{
+  u32 size = (u32)MAX(1, primary_brush_size);
+  switch (primary_brush_type) {
+    case BRUSH_RECT:
+      pixel_spans_rect(&stroke_spans, col, row, size, size);
+      break;
+    case BRUSH_CIRCLE:
+      pixel_spans_circle(&stroke_spans, col, row, size);
+      break;
+    case BRUSH_LINE:
+      for (u32 direction = 0; direction < 4; direction++) {
+        pixel_spans_line(&stroke_spans, col, row, size, direction);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Puts the brush down on every cell of the line from the last one up to
+// (col, row), Bresenham, so fast strokes have no gaps. (col, row) itself is
+// left to the next segment or to game__stroke.
+internal void
+game__stroke_to(i32 col, i32 row)
+{
+  if (!stroke_active) {
+    stroke_active = true;
+    stroke_col = col;
+    stroke_row = row;
+    return;
+  }
+
+  i32 dx = abs(col - stroke_col);
+  i32 dy = -abs(row - stroke_row);
+  i32 step_x = stroke_col < col ? 1 : -1;
+  i32 step_y = stroke_row < row ? 1 : -1;
+  i32 error = dx + dy;
+  i32 x = stroke_col;
+  i32 y = stroke_row;
+  while (x != col || y != row) {
+    game__stroke_brush(x, y);
+    i32 error2 = error * 2;
+    if (error2 >= dy) {
+      error += dy;
+      x += step_x;
+    }
+    if (error2 <= dx) {
+      error += dx;
+      y += step_y;
+    }
+  }
+
+  stroke_col = col;
+  stroke_row = row;
+}
+
+// Draws the brush along every mouse sample of the frame and always on the
+// cell under the cursor, so holding still keeps painting. Overlapping stamps
+// are merged first so each cell is written once.
+internal void
+game__stroke(app_t* game, pixel_t pixel, bool erase)
+{
+  stroke_spans.count = 0;
+  for (u32 i = 0; i < game->stroke.count; i++) {
+    app_stroke_sample_t sample = game->stroke.samples[i];
+    game__stroke_to(posToGridWithOffsetX(sample.x - game->camera.x), posToGridWithOffsetY(sample.y - game->camera.y));
+  }
+  game__stroke_to((i32)pixel.col, (i32)pixel.row);
+  game__stroke_brush((i32)pixel.col, (i32)pixel.row);
+
+  pixel_spans_coalesce(&stroke_spans);
+  pixel_buffer_stamp(&frames[active_frame_buffer_index], stroke_spans.items, stroke_spans.count, pixel, erase);
+}
+
+// a frame being written on the worker, see game__save
+typedef struct
+{
+  pixel_buffer_t frame;
+  char filename[255];
+  bool png;
+  bool saved;
+} game_save_t;
+
+internal void
+game__save_run(void* data)
+{
+  game_save_t* save = (game_save_t*)data;
+  if (save->png) {
+    save->saved = pixel_buffer_save_png(&save->frame, save->filename, 1);
+  } else {
+    save->saved = pixel_buffer_save(&save->frame, save->filename);
+  }
+}
+
+internal void
+game__save_done(void* data)
+{
+  game_save_t* save = (game_save_t*)data;
+  if (save->saved) {
+    sprintf(file_status, "Saved to %s", save->filename);
+  } else {
+    sprintf(file_status, "Unable to save %s", save->filename);
+  }
+  file_status_until = SDL_GetTicks() + 3000;
+
+  pixel_buffer_destroy(&save->frame);
+  free(save);
+}
+
+// Saves the active frame as .psb, or exports it as .png, named after the
+// current time. The frame is copied as it is now and written on the worker,
+// painting and simulating go on meanwhile.
+internal void
+game__save(bool png)
+{
+  game_save_t* save = (game_save_t*)malloc(sizeof(game_save_t));
+  time_t t = time(NULL);
+  struct tm tm = *localtime(&t);
+  sprintf(save->filename, "pixsim-export-%d-%d-%d_%d-%d-%d.%s", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, png ? "png" : "psb");
+  save->png = png;
+  save->saved = false;
+
+  pixel_buffer_init_size(&save->frame, 1, 1);
+  pixel_buffer_copy(&save->frame, &frames[active_frame_buffer_index]);
+
+  sprintf(file_status, "Saving %s", save->filename);
+  file_status_until = UINT32_MAX;
+  dk_worker_push(&worker, game__save_run, game__save_done, save);
+}
+
+// dk_ui_icon_button reports a button for as long as it is held, what should
+// happen once per click goes through here
+internal bool
+game__clicked(bool pressed, bool* held)
+{
+  bool clicked = pressed && !*held;
+  *held = pressed;
+  return clicked;
+}
+
 void
 game_update(app_t* game)
 {
+  // finished saves report back, and their message goes away after a while
+  dk_worker_poll(&worker);
+  if (file_status[0] != '\0' && SDL_GetTicks() >= file_status_until) {
+    file_status[0] = '\0';
+    game->redraw_frames = 2;
+  }
+
   switch (game->state) {
     case MENU:
       break;
@@ -310,10 +684,10 @@ game_update(app_t* game)
       SDL_GetMouseState(&game->mouse.x, &game->mouse.y);
 
       bool is_in_bounds =
-          game->mouse.x > (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2 &&
-          game->mouse.x < (WINDOW_WIDTH + GRID_WIDTH * pixel_size) / 2 &&
-          game->mouse.y > (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2 &&
-          game->mouse.y < (WINDOW_HEIGHT + GRID_HEIGHT * pixel_size) / 2;
+          game->mouse.x > (WINDOW_WIDTH - canvas_width()) / 2 &&
+          game->mouse.x < (WINDOW_WIDTH + canvas_width()) / 2 &&
+          game->mouse.y > (WINDOW_HEIGHT - canvas_height()) / 2 &&
+          game->mouse.y < (WINDOW_HEIGHT + canvas_height()) / 2;
 
 			if (is_in_bounds) {
         game->mouse.x -= game->camera.x;
@@ -328,7 +702,6 @@ game_update(app_t* game)
         pixel_t pixel = {
           .col = coord_x,
           .row = coord_y,
-          .size = pixel_size,
           .type = primary_pixel_type,
           .color = primary_color
         };
@@ -344,29 +717,31 @@ game_update(app_t* game)
 
           switch(primary_brush_type) {
             case BRUSH_RECT:
-              pixel_buffer_add_rect(&frames[active_frame_buffer_index], pixel, primary_brush_size, primary_brush_size, is_erasing);
-              break;
             case BRUSH_CIRCLE:
-              pixel_buffer_add_circle(&frames[active_frame_buffer_index], pixel, primary_brush_size, is_erasing);
-              break;
             case BRUSH_LINE:
-              pixel_buffer_add_line(&frames[active_frame_buffer_index], pixel, primary_brush_size, 0, is_erasing);
-              pixel_buffer_add_line(&frames[active_frame_buffer_index], pixel, primary_brush_size, 1, is_erasing);
-              pixel_buffer_add_line(&frames[active_frame_buffer_index], pixel, primary_brush_size, 2, is_erasing);
-              pixel_buffer_add_line(&frames[active_frame_buffer_index], pixel, primary_brush_size, 3, is_erasing);
+              game__stroke(game, pixel, is_erasing);
+              break;
+            case BRUSH_FILL:
+              // once per click, holding the button does not fill again
+              if (!fill_done) {
+                pixel_buffer_fill(&frames[active_frame_buffer_index], pixel, primary_fill_mode, is_erasing);
+                fill_done = true;
+              }
               break;
             case BRUSH_PENCIL:
               pixel_buffer_add(&frames[active_frame_buffer_index], pixel);
             case BRUSH_ERASER:
               pixel_buffer_clear(&frames[active_frame_buffer_index]);
             case BRUSH_RECT_OUTLINE:
-              pixel_t *p = pixel_buffer_get_pixel_ptr(&frames[active_frame_buffer_index], coord_x, coord_y);
-              if (p != NULL) {
-                pixel_buffer_shade_pixel(&frames[active_frame_buffer_index], p, primary_brush_size);
-              }
+              pixel_buffer_shade_pixel(&frames[active_frame_buffer_index], coord_x, coord_y, primary_brush_size);
               break;
           }
+        } else {
+          stroke_active = false;
         }
+      } else {
+        stroke_active = false;
+        fill_done = false;
       }
 
       if (SDL_GetKeyboardState(NULL)[SDL_SCANCODE_UP] || SDL_GetKeyboardState(NULL)[SDL_SCANCODE_W]) {
@@ -389,9 +764,8 @@ game_update(app_t* game)
         }
       }
 
-      for (int i = 0; i < frames[active_frame_buffer_index].count; i++) {
-        frames[active_frame_buffer_index].pixels[i].size = pixel_size;
-      }
+      // zoom is a view transform, the frame itself does not know about it
+      game->camera.zoom = pixel_size;
 
       if (game->game_state.simulation_running) {
         update_pixel_simulation(&frames[active_frame_buffer_index]);
@@ -401,6 +775,9 @@ game_update(app_t* game)
     case GAME_OVER:
       break;
   }
+
+  // the samples are used up, the next frame brings its own
+  game->stroke.count = 0;
 }
 
 void text_input_handler(char* text_input_buffer)
@@ -442,10 +819,10 @@ game_render(app_t* game)
       SDL_RenderClear(game->renderer);
 
       SDL_Rect canvas_rect = {
-        (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2,
-        (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2,
-        GRID_WIDTH * pixel_size,
-        GRID_HEIGHT * pixel_size
+        (WINDOW_WIDTH - canvas_width()) / 2,
+        (WINDOW_HEIGHT - canvas_height()) / 2,
+        canvas_width(),
+        canvas_height()
       };
 
       canvas_rect.x += game->camera.x;
@@ -460,23 +837,10 @@ game_render(app_t* game)
         SDL_Color grid_color = C64_LIGHT_GREY;
         SDL_SetRenderDrawColor(game->renderer, grid_color.r, grid_color.g, grid_color.b, grid_color.a);
 
-        for (int i = 0; i < GRID_WIDTH; i++) {
-              SDL_RenderDrawLine(game->renderer,
-                                 (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2 + i * pixel_size + game->camera.x,
-                                 (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2 + game->camera.y,
-                                 (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2 + i * pixel_size + game->camera.x,
-                                 (WINDOW_HEIGHT + GRID_HEIGHT * pixel_size) / 2 + game->camera.y);
-          for (int j = 0; j < GRID_HEIGHT; j++) {
-            SDL_RenderDrawLine(game->renderer,
-                               (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2 + game->camera.x,
-                               (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2 + j * pixel_size + game->camera.y,
-                               (WINDOW_WIDTH + GRID_WIDTH * pixel_size) / 2 + game->camera.x,
-                               (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2 + j * pixel_size + game->camera.y);
-          }
-        }
+        dk_canvas_draw_grid(&canvas, &frames[active_frame_buffer_index], &game->camera);
       }
 
-      pixel_buffer_draw(&frames[active_frame_buffer_index], &game->camera, game->renderer);
+      dk_canvas_draw(&canvas, &frames[active_frame_buffer_index], &game->camera);
 
       SDL_RenderDrawRect(game->renderer, &canvas_rect);
 
@@ -485,17 +849,17 @@ game_render(app_t* game)
 
       SDL_Rect cursor_rect = { x - pixel_size / 2, y - pixel_size / 2, pixel_size, pixel_size };
 
-      cursor_rect.x = (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2 + x * pixel_size;
-      cursor_rect.y = (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2 + y * pixel_size;
+      cursor_rect.x = (WINDOW_WIDTH - canvas_width()) / 2 + x * pixel_size;
+      cursor_rect.y = (WINDOW_HEIGHT - canvas_height()) / 2 + y * pixel_size;
 
       cursor_rect.x += game->camera.x;
       cursor_rect.y += game->camera.y;
 
       bool is_in_bounds =
-        game->mouse.x > (WINDOW_WIDTH - GRID_WIDTH * pixel_size) / 2 &&
-        game->mouse.x < (WINDOW_WIDTH + GRID_WIDTH * pixel_size) / 2 &&
-        game->mouse.y > (WINDOW_HEIGHT - GRID_HEIGHT * pixel_size) / 2 &&
-        game->mouse.y < (WINDOW_HEIGHT + GRID_HEIGHT * pixel_size) / 2;
+        game->mouse.x > (WINDOW_WIDTH - canvas_width()) / 2 &&
+        game->mouse.x < (WINDOW_WIDTH + canvas_width()) / 2 &&
+        game->mouse.y > (WINDOW_HEIGHT - canvas_height()) / 2 &&
+        game->mouse.y < (WINDOW_HEIGHT + canvas_height()) / 2;
 
       if (is_in_bounds) {
         SDL_Color cursor_color = C64_LIGHT_BLUE;
@@ -523,14 +887,22 @@ game_render(app_t* game)
         rect.w = WINDOW_WIDTH;
         rect.h = 40;
 
-        SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
-        SDL_RenderFillRect(game->renderer, &rect);
+        dk_ui_rect(game, rect, C64_BLACK);
       }
       {
         char str[255];
-        sprintf(str, "B:%d (%d, %d)", primary_brush_size, x, y);
+        if (primary_brush_type == BRUSH_FILL) {
+          sprintf(str, "Fill:%s (%d, %d)", primary_fill_mode == PIXEL_FILL_COLOR ? "color" : "material", x, y);
+        } else {
+          sprintf(str, "B:%d (%d, %d)", primary_brush_size, x, y);
+        }
         SDL_Point position = { WINDOW_WIDTH - dk_text_width(&game->ui_text, str), WINDOW_HEIGHT - dk_text_height(&game->ui_text, str) - 10 };
-        dk_text_draw(&game->ui_text, str, position.x, position.y);
+        dk_ui_text(game, str, position.x, position.y);
+
+        // right of the zoom buttons
+        if (file_status[0] != '\0') {
+          dk_ui_text(game, file_status, 110, WINDOW_HEIGHT - dk_text_height(&game->ui_text, file_status) - 10);
+        }
       }
 
       {
@@ -539,7 +911,7 @@ game_render(app_t* game)
         rect.y = WINDOW_HEIGHT - 35;
         rect.w = 35;
         rect.h = 35;
-        if(dk_ui_icon_button(game, rect, C64_WHITE, icons[ICON_ZOOM_IN].texture, &game->ui_focused)) {
+        if(dk_ui_icon_button(game, rect, C64_WHITE, &icons[ICON_ZOOM_IN], &game->ui_focused)) {
           if (primary_brush_size < 20) primary_brush_size++;
         }
       }
@@ -550,7 +922,7 @@ game_render(app_t* game)
         rect.y = WINDOW_HEIGHT - 35;
         rect.w = 35;
         rect.h = 35;
-        if(dk_ui_icon_button(game, rect, C64_WHITE, icons[ICON_ZOOM_OUT].texture, &game->ui_focused)) {
+        if(dk_ui_icon_button(game, rect, C64_WHITE, &icons[ICON_ZOOM_OUT], &game->ui_focused)) {
           if (primary_brush_size > 1) primary_brush_size--;
         }
       }
@@ -561,13 +933,11 @@ game_render(app_t* game)
       static i32 icon_offset_x = 0;
 
       SDL_Rect panel_rect = { 0, 0, WINDOW_WIDTH, icon_size + icon_padding * 2 };
-      SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
-      SDL_RenderFillRect(game->renderer, &panel_rect);
+      dk_ui_rect(game, panel_rect, C64_BLACK);
 
       SDL_Rect rect10 = { (icon_offset_x + icon_padding), icon_pos_y, icons[ICON_GRID].rect.w, icons[ICON_GRID].rect.h };
       SDL_Color grid_icon_color = game->game_state.grid_enabled ? C64_LIGHT_GREEN : C64_WHITE;
-      SDL_PollEvent(&game->event);
-      if(dk_ui_icon_button(game, rect10, grid_icon_color, icons[ICON_GRID].texture, &game->ui_focused)) {
+      if(dk_ui_icon_button(game, rect10, grid_icon_color, &icons[ICON_GRID], &game->ui_focused)) {
         SDL_Delay(100);
         game->game_state.grid_enabled = !game->game_state.grid_enabled;
         SDL_Delay(0);
@@ -575,37 +945,29 @@ game_render(app_t* game)
 
       SDL_Rect rect7 = { (rect10.x + icon_size + icon_padding), icon_pos_y, icons[ICON_PLAY].rect.w, icons[ICON_PLAY].rect.h };
       SDL_Color play_icon_color = game->game_state.simulation_running ? C64_LIGHT_GREEN : C64_LIGHT_BLUE;
-      if (dk_ui_icon_button(game, rect7, play_icon_color, icons[ICON_PLAY].texture, &game->ui_focused)) {
+      if (dk_ui_icon_button(game, rect7, play_icon_color, &icons[ICON_PLAY], &game->ui_focused)) {
         game->game_state.simulation_running = true;
       }
 
       SDL_Rect rect11 = { rect7.x + icon_size + icon_padding, icon_pos_y, icons[ICON_PAUSE].rect.w, icons[ICON_PAUSE].rect.h };
       SDL_Color pause_icon_color = game->game_state.simulation_running ? C64_LIGHT_BLUE : C64_LIGHT_RED;
-      if (dk_ui_icon_button(game, rect11, pause_icon_color, icons[ICON_PAUSE].texture, &game->ui_focused)) {
+      if (dk_ui_icon_button(game, rect11, pause_icon_color, &icons[ICON_PAUSE], &game->ui_focused)) {
         game->game_state.simulation_running = false;
       }
 
       SDL_Rect rect9 = { rect11.x + icon_size + icon_padding, icon_pos_y, icons[ICON_CLEAR].rect.w, icons[ICON_CLEAR].rect.h };
-      if (dk_ui_icon_button(game, rect9, C64_LIGHT_RED, icons[ICON_CLEAR].texture, &game->ui_focused)) {
+      if (dk_ui_icon_button(game, rect9, C64_LIGHT_RED, &icons[ICON_CLEAR], &game->ui_focused)) {
         pixel_buffer_clear(&frames[active_frame_buffer_index]);
       }
 
       SDL_Rect rect8 = { rect9.x + icon_size + icon_padding, icon_pos_y, icons[ICON_SAVE].rect.w, icons[ICON_SAVE].rect.h };
-      if (dk_ui_icon_button(game, rect8, C64_LIGHT_GREEN, icons[ICON_SAVE].texture, &game->ui_focused)) {
-        char filename[255];
-        time_t t = time(NULL);
-
-        struct tm tm = *localtime(&t);
-        sprintf(filename, "pixsim-export-%d-%d-%d_%d-%d-%d.psb", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-        pixel_buffer_save(&frames[active_frame_buffer_index], filename);
-
-        char str[512];
-        sprintf(str, "File Saved to %s", filename);
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Saved!", (const char*)str, NULL);
+      static bool save_held = false;
+      if (game__clicked(dk_ui_icon_button(game, rect8, C64_LIGHT_GREEN, &icons[ICON_SAVE], &game->ui_focused), &save_held)) {
+        game__save(false);
       }
 
       SDL_Rect rect12 = { rect8.x + icon_size + icon_padding, icon_pos_y, icons[ICON_EXIT].rect.w, icons[ICON_EXIT].rect.h };
-      if (dk_ui_icon_button(game, rect12, C64_LIGHT_RED, icons[ICON_EXIT].texture, &game->ui_focused)) {
+      if (dk_ui_icon_button(game, rect12, C64_LIGHT_RED, &icons[ICON_EXIT], &game->ui_focused)) {
 
         SDL_MessageBoxButtonData buttons[] = {
           { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 0, "Yes" },
@@ -651,17 +1013,9 @@ game_render(app_t* game)
             game->running = false;
           }
 
+          // written while the game shuts down, see game_destroy
           if (buttonid == 0) {
-            char filename[255];
-            time_t t = time(NULL);
-
-            struct tm tm = *localtime(&t);
-            sprintf(filename, "pixsim-export-%d-%d-%d_%d-%d-%d.psb", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-            pixel_buffer_save(&frames[active_frame_buffer_index], filename);
-
-            char str[512];
-            sprintf(str, "File Saved to %s", filename);
-            SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Saved!", (const char*)str, NULL);
+            game__save(false);
           }
 
           game->running = false;
@@ -671,72 +1025,21 @@ game_render(app_t* game)
 
       // COPY BUTTON
       SDL_Rect rect13 = { rect12.x + icon_size + icon_padding, icon_pos_y, icons[ICON_COPY_BUFFER].rect.w, icons[ICON_COPY_BUFFER].rect.h };
-      if (dk_ui_icon_button(game, rect13, C64_LIGHT_BLUE, icons[ICON_COPY_BUFFER].texture, &game->ui_focused)) {
+      if (dk_ui_icon_button(game, rect13, C64_LIGHT_BLUE, &icons[ICON_COPY_BUFFER], &game->ui_focused)) {
         dk_clipboard_set(clipboard, &frames[active_frame_buffer_index]);
       }
 
       // PASTE BUTTON
       SDL_Rect rect14 = { rect13.x + icon_size + icon_padding, icon_pos_y, icons[ICON_PASTE_BUFFER].rect.w, icons[ICON_PASTE_BUFFER].rect.h };
-      if (dk_ui_icon_button(game, rect14, C64_LIGHT_BLUE, icons[ICON_PASTE_BUFFER].texture, &game->ui_focused)) {
+      if (dk_ui_icon_button(game, rect14, C64_LIGHT_BLUE, &icons[ICON_PASTE_BUFFER], &game->ui_focused)) {
         dk_clipboard_paste_to_buffer(clipboard, &frames[active_frame_buffer_index]);
       }
 
       // EXPORT IMAGE BUTTON
       SDL_Rect rect15 = { rect14.x + icon_size + icon_padding, icon_pos_y, icons[IOCN_EXPORT_IMAGE].rect.w, icons[IOCN_EXPORT_IMAGE].rect.h };
-      if (dk_ui_icon_button(game, rect15, C64_LIGHT_BLUE, icons[IOCN_EXPORT_IMAGE].texture, &game->ui_focused)) {
-        char filename[255];
-        time_t t = time(NULL);
-
-        struct tm tm = *localtime(&t);
-        sprintf(filename, "pixsim-export-%d-%d-%d_%d-%d-%d.png", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-        pixel_buffer_save_png(&frames[active_frame_buffer_index], filename, 1);
-
-        char str[512];
-        sprintf(str, "File Saved to %s", filename);
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Saved!", (const char*)str, NULL);
-      }
-
-      {
-        bool is_visible = false;
-        dk_ui_tooltip(game, rect8, "Save Buffer", &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        dk_ui_tooltip(game, rect9, "Clear Canvas", &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        dk_ui_tooltip(game, rect11, "Stop Simulation", &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        dk_ui_tooltip(game, rect7, "Play Simulation", &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        dk_ui_tooltip(game, rect12, "Quit Program", &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        char* str = "Enable/Disable Grid";
-        dk_ui_tooltip(game, rect10, str, &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        char* str = "Copy Buffer";
-        dk_ui_tooltip(game, rect13, str, &is_visible);
-      }
-
-      {
-        bool is_visible = false;
-        char* str = "Paste In Buffer";
-        dk_ui_tooltip(game, rect14, str, &is_visible);
+      static bool export_held = false;
+      if (game__clicked(dk_ui_icon_button(game, rect15, C64_LIGHT_BLUE, &icons[IOCN_EXPORT_IMAGE], &game->ui_focused), &export_held)) {
+        game__save(true);
       }
 
       static i32 size = 25;
@@ -783,7 +1086,7 @@ game_render(app_t* game)
           color = C64_LIGHT_GREEN;
         }
 
-        if (dk_ui_icon_button(game, rect, color, icons[ICON_BRUSH_CIRCLE].texture, &game->ui_focused)) {
+        if (dk_ui_icon_button(game, rect, color, &icons[ICON_BRUSH_CIRCLE], &game->ui_focused)) {
           primary_brush_type = BRUSH_CIRCLE;
         }
       }
@@ -802,7 +1105,7 @@ game_render(app_t* game)
           color = C64_LIGHT_GREEN;
         }
 
-        if (dk_ui_icon_button(game, rect, color, icons[ICON_BRUSH_CROSS].texture, &game->ui_focused)) {
+        if (dk_ui_icon_button(game, rect, color, &icons[ICON_BRUSH_CROSS], &game->ui_focused)) {
           primary_brush_type = BRUSH_LINE;
         }
       }
@@ -821,7 +1124,7 @@ game_render(app_t* game)
           color = C64_LIGHT_GREEN;
         }
 
-        if (dk_ui_icon_button(game, rect, color, icons[ICON_BRUSH_RECT].texture, &game->ui_focused)) {
+        if (dk_ui_icon_button(game, rect, color, &icons[ICON_BRUSH_RECT], &game->ui_focused)) {
           primary_brush_type = BRUSH_RECT;
         }
       }
@@ -840,7 +1143,7 @@ game_render(app_t* game)
           color = C64_LIGHT_GREEN;
         }
 
-        if (dk_ui_icon_button(game, rect, color, icons[ICON_BRUSH_RECT_OUTLINE].texture, &game->ui_focused)) {
+        if (dk_ui_icon_button(game, rect, color, &icons[ICON_BRUSH_RECT_OUTLINE], &game->ui_focused)) {
           primary_brush_type = BRUSH_RECT_OUTLINE;
         }
       }
@@ -854,12 +1157,10 @@ game_render(app_t* game)
 
         int icon_offset = ((int)ICON_NUMBER0 + (i + 1  ));
         if (i == active_frame_buffer_index) {
-          SDL_Color color = C64_LIGHT_BLUE;
-          SDL_SetRenderDrawColor(game->renderer, color.r, color.g, color.b, color.a);
-          SDL_RenderFillRect(game->renderer, &rect);
+          dk_ui_rect(game, rect, C64_LIGHT_BLUE);
         }
 
-        if(dk_ui_icon_button(game, rect, C64_ORANGE, icons[icon_offset].texture, &game->ui_focused)) {
+        if(dk_ui_icon_button(game, rect, C64_ORANGE, &icons[icon_offset], &game->ui_focused)) {
           active_frame_buffer_index = i;
         }
       }
@@ -875,22 +1176,66 @@ game_render(app_t* game)
 
         SDL_Color color = pixel_type_to_color(i);
         if (i == primary_pixel_type) {
-          SDL_Color bg_color = C64_LIGHT_BLUE;
-          SDL_SetRenderDrawColor(game->renderer, bg_color.r, bg_color.g, bg_color.b, bg_color.a);
-          SDL_RenderFillRect(game->renderer, &rect);
+          dk_ui_rect(game, rect, C64_LIGHT_BLUE);
         }
 
         int icon_offset = ((int)ICON_BRUSH_RECT_OUTLINE + (i + 1));
-        if (dk_ui_icon_button(game, rect, color, icons[icon_offset].texture, &game->ui_focused)) {
+        if (dk_ui_icon_button(game, rect, color, &icons[icon_offset], &game->ui_focused)) {
           primary_pixel_type = i;
         }
       }
 
+      // tooltips last, over the icons
+      {
+        bool is_visible = false;
+        dk_ui_tooltip(game, rect8, "Save Buffer", &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        dk_ui_tooltip(game, rect9, "Clear Canvas", &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        dk_ui_tooltip(game, rect11, "Stop Simulation", &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        dk_ui_tooltip(game, rect7, "Play Simulation", &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        dk_ui_tooltip(game, rect12, "Quit Program", &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        char* str = "Enable/Disable Grid";
+        dk_ui_tooltip(game, rect10, str, &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        char* str = "Copy Buffer";
+        dk_ui_tooltip(game, rect13, str, &is_visible);
+      }
+
+      {
+        bool is_visible = false;
+        char* str = "Paste In Buffer";
+        dk_ui_tooltip(game, rect14, str, &is_visible);
+      }
+
       // @dev @tileset
       if (SDL_GetKeyboardState(NULL)[SDL_SCANCODE_SPACE]) {
 
         game->ui_focused = true;
 
+        // the tileset view covers the whole window, the widgets stay hidden
+        dk_batch_clear(&game->ui_batch);
         SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
         SDL_RenderClear(game->renderer);
 
@@ -958,19 +1303,200 @@ game_render(app_t* game)
     } break;
   }
 
+  // the widgets recorded this frame, over everything else
+  dk_batch_flush(&game->ui_batch);
   SDL_RenderPresent(game->renderer);
 }
 
+#define HEADLESS_MAX_SCALES 8
+
+typedef struct
+{
+  const char* input;
+  const char* output;
+  u32 ticks;
+  u64 seed;
+  bool print_hashes;
+  bool verify;
+  // PNG output pixels per cell, 1 when none are given
+  u32 scales[HEADLESS_MAX_SCALES];
+  u32 scale_count;
+} headless_options_t;
+
+// Writes the frame as PNG at every scale of the options from one pass over
+// it. With more than one scale every image is named after output with @Nx
+// before the extension, "shot.png" at 4 and 8 gives shot@4x.png and
+// shot@8x.png.
+internal bool
+headless__save_pngs(headless_options_t* options, pixel_buffer_t* buffer)
+{
+  u32 scale_one = 1;
+  u32 count = options->scale_count > 0 ? options->scale_count : 1;
+  const u32* scales = options->scale_count > 0 ? options->scales : &scale_one;
+  if (count == 1) {
+    return pixel_buffer_save_png(buffer, options->output, scales[0]);
+  }
+
+  char names[HEADLESS_MAX_SCALES][512];
+  const char* filenames[HEADLESS_MAX_SCALES];
+  int stem = (int)(strrchr(options->output, '.') - options->output);
+  for (u32 i = 0; i < count; i++) {
+    snprintf(names[i], sizeof(names[i]), "%.*s@%ux%s", stem, options->output, scales[i], options->output + stem);
+    filenames[i] = names[i];
+  }
+  return pixel_buffer_save_pngs(buffer, filenames, scales, count);
+}
+
+// Runs the simulation on a .psb file without a window, renderer or frame cap
+// and reports the raw engine throughput. The final state is written to
+// output when given, as PNG when the name ends in .png (at every scale of
+// --scales), as PSB otherwise.
+//
+// print_hashes prints the state hash after every tick, two runs with the same
+// file, ticks and seed print the same lines. verify steps a second copy with
+// dk_simulation_step_reference and stops at the first tick the hashes differ.
+int
+headless_run(headless_options_t* options)
+{
+  pixel_buffer_t buffer;
+  pixel_buffer_init(&buffer);
+
+  if (!pixel_buffer_load(&buffer, options->input)) {
+    fprintf(stderr, "pixsim: unable to load %s\n", options->input);
+    return EXIT_FAILURE;
+  }
+
+  pixel_buffer_t reference;
+  if (options->verify) {
+    pixel_buffer_init(&reference);
+    pixel_buffer_load(&reference, options->input);
+  }
+
+  dk_simulation_set_seed(options->seed);
+
+  f64 seconds = 0;
+  for (u32 i = 0; i < options->ticks; i++) {
+
+    // only the engine step is timed, hashing and verifying are not
+    u64 start = SDL_GetPerformanceCounter();
+    update_pixel_simulation(&buffer);
+    seconds += (f64)(SDL_GetPerformanceCounter() - start) / (f64)SDL_GetPerformanceFrequency();
+
+    if (options->print_hashes) {
+      printf("%u %016llx\n", buffer.tick, dk_simulation_hash(&buffer));
+    }
+
+    if (options->verify) {
+      dk_simulation_step_reference(&reference);
+      if (dk_simulation_hash(&buffer) != dk_simulation_hash(&reference)) {
+        fprintf(stderr, "pixsim: tick %u differs from the reference simulation\n", buffer.tick);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  f64 ticks_per_second = seconds > 0 ? options->ticks / seconds : 0;
+
+  // the simulation only moves particles around, the count never changes
+  printf("%s: %ux%u, %u particles, %u threads, seed %llu\n",
+         options->input, buffer.width, buffer.height, buffer.count,
+         dk_simulation_get_thread_count(), options->seed);
+  printf("%u ticks in %.3f s, %.1f ticks/s, %.0f particles/s\n",
+         options->ticks, seconds, ticks_per_second, ticks_per_second * buffer.count);
+  if (options->verify) {
+    printf("matches the reference simulation, final hash %016llx\n", dk_simulation_hash(&buffer));
+  }
+
+  int result = EXIT_SUCCESS;
+  if (options->output != NULL) {
+    const char* extension = strrchr(options->output, '.');
+    bool saved = false;
+    if (extension != NULL && strcmp(extension, ".png") == 0) {
+      saved = headless__save_pngs(options, &buffer);
+    } else {
+      saved = pixel_buffer_save(&buffer, options->output);
+    }
+    if (!saved) {
+      fprintf(stderr, "pixsim: unable to save %s\n", options->output);
+      result = EXIT_FAILURE;
+    }
+  }
+
+  pixel_buffer_destroy(&buffer);
+  if (options->verify) {
+    pixel_buffer_destroy(&reference);
+  }
+  dk_simulation_destroy();
+  return result;
+}
+
 int
 main(int argc, char const* argv[])
 {
   srand((unsigned int)time(NULL));
 
+  // --threads N, simulation threads, 0 (the default) uses every core
+  // --size WxH, size of new frames in cells, up to GRID_MAX_WIDTH x GRID_MAX_HEIGHT
+  // --seed N, seed of the simulation random streams
+  // --headless FILE.psb [--ticks N] [--out FILE.psb|FILE.png] [--scales N,N...]
+  //   [--hash] [--verify], see headless_run
+  u32 thread_count = 0;
+  headless_options_t headless = { .ticks = 1000 };
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      thread_count = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      headless.seed = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+      headless.input = argv[++i];
+    } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      headless.ticks = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      headless.output = argv[++i];
+    } else if (strcmp(argv[i], "--scales") == 0 && i + 1 < argc) {
+      const char* list = argv[++i];
+      headless.scale_count = 0;
+      while (*list != '\0' && headless.scale_count < HEADLESS_MAX_SCALES) {
+        char* end = NULL;
+        unsigned long scale = strtoul(list, &end, 10);
+        if (end == list) {
+          break;
+        }
+        if (scale > 0) {
+          headless.scales[headless.scale_count++] = (u32)scale;
+        }
+        list = *end == ',' ? end + 1 : end;
+      }
+    } else if (strcmp(argv[i], "--hash") == 0) {
+      headless.print_hashes = true;
+    } else if (strcmp(argv[i], "--verify") == 0) {
+      headless.verify = true;
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      u32 width = 0, height = 0;
+      if (sscanf(argv[++i], "%ux%u", &width, &height) == 2 && width > 0 && height > 0) {
+        frame_width = MIN(width, GRID_MAX_WIDTH);
+        frame_height = MIN(height, GRID_MAX_HEIGHT);
+      }
+    }
+  }
+  dk_simulation_set_thread_count(thread_count);
+  dk_simulation_set_seed(headless.seed);
+
+  if (headless.input != NULL) {
+    return headless_run(&headless);
+  }
+
   app_t game;
   game_init(&game);
 
   while (game.running) {
 
+    // Idle: nothing moves until an event comes in (input, a window expose or
+    // app_wake), so block for it instead of drawing the same frame again.
+    if (!game_is_animating(&game) && game.redraw_frames == 0) {
+      SDL_WaitEventTimeout(NULL, APP_IDLE_WAIT_MS);
+    }
+
     game.stats.FrameCount++;
     game.stats._currentTime = SDL_GetTicks();
     game.stats.DeltaTime = game.stats._currentTime - game.stats._lastTime;
@@ -987,12 +1513,20 @@ main(int argc, char const* argv[])
 
     game_handle_events(&game);
     game_update(&game);
+
+    if (game.redraw_frames == 0 && !game_is_animating(&game)) {
+      continue;
+    }
+    game.redraw_frames = game.redraw_frames > 0 ? game.redraw_frames - 1 : 0;
     game_render(&game);
 
-    int target_frame_time = 1000 / 60; // 60 FPS
-    int frame_time = SDL_GetTicks() - game.stats._lastFrame;
-    if (frame_time < target_frame_time) {
-      SDL_Delay(target_frame_time - frame_time);
+    // presenting already waits for the display with vsync on
+    if (!game.vsync) {
+      int target_frame_time = 1000 / 60; // 60 FPS
+      int frame_time = SDL_GetTicks() - game.stats._lastFrame;
+      if (frame_time < target_frame_time) {
+        SDL_Delay(target_frame_time - frame_time);
+      }
     }
   }
 
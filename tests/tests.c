@@ -0,0 +1,396 @@
+#include "dk.h"
+
+#if defined(__APPLE__) || defined(__MACH__)
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#endif
+
+#if defined(__linux__) || defined(__unix__)
+#include <SDL.h>
+#include <SDL_image.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DK_COLOR_IMPLEMENTATION
+#include "dk_color.h"
+
+#define DK_PIXELBUFFER_IMPLEMENTATION
+#include "dk_pixelbuffer.h"
+
+#define DK_SIMULATION_IMPLEMENTATION
+#include "dk_simulation.h"
+
+//
+// Regression tests, one line per case and a non zero exit code when any of
+// them fails.
+//
+//   tests [--filter NAME]
+//
+
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 128
+#define TEST_TICKS 150
+#define TEST_FILE_PSB "tests.psb"
+
+typedef bool (*test_fn)(void);
+
+typedef struct
+{
+  const char* name;
+  test_fn run;
+} test_case_t;
+
+// Columns straddling the boundary between the first two chunk rows, far
+// enough from the chunk columns' borders that nothing reaches them.
+void
+test_fill_columns(pixel_buffer_t* buffer, pixel_type_t type)
+{
+  pixel_buffer_init_size(buffer, TEST_WIDTH, TEST_HEIGHT);
+  pixel_buffer_wake_all(buffer);
+
+  u32 cols[] = { GRID_CHUNK_SIZE / 2, GRID_CHUNK_SIZE * 5 / 2 };
+  for (u32 i = 0; i < sizeof(cols) / sizeof(cols[0]); i++) {
+    for (u32 row = GRID_CHUNK_SIZE - 6; row < GRID_CHUNK_SIZE + 6; row++) {
+      pixel_t pixel = { 0 };
+      pixel.col = cols[i];
+      pixel.row = row;
+      pixel.type = type;
+      pixel.color = pixel_type_to_color(type);
+      pixel_buffer_add(buffer, pixel);
+    }
+  }
+}
+
+// One tick the plain way: every row of the grid bottom first, left to right
+// inside a row, no chunks and no threads.
+void
+test_step_full_scan(pixel_buffer_t* buffer)
+{
+  dk_simulation__begin(buffer);
+  for (u32 row = buffer->height - 1; row-- > 0;) {
+    for (u32 col = 0; col < buffer->width; col++) {
+      dk_simulation__update_cell(buffer, dk_simulation.moved, col, row);
+    }
+  }
+  buffer->tick++;
+}
+
+bool
+test_columns_fall_like_full_scan(pixel_type_t type, u32 ticks)
+{
+  static const u32 thread_counts[] = { 1, 4 };
+  bool passed = true;
+
+  for (u32 t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]) && passed; t++) {
+    dk_simulation_set_thread_count(thread_counts[t]);
+
+    pixel_buffer_t chunked;
+    pixel_buffer_t scanned;
+    test_fill_columns(&chunked, type);
+    test_fill_columns(&scanned, type);
+
+    for (u32 tick = 0; tick < ticks; tick++) {
+      dk_simulation_step(&chunked);
+      test_step_full_scan(&scanned);
+
+      if (dk_simulation_hash(&chunked) != dk_simulation_hash(&scanned)) {
+        fprintf(stderr, "  %u thread(s), tick %u: chunked step differs from the full scan\n", thread_counts[t], tick);
+        passed = false;
+        break;
+      }
+    }
+
+    pixel_buffer_destroy(&chunked);
+    pixel_buffer_destroy(&scanned);
+  }
+
+  dk_simulation_set_thread_count(1);
+  return passed;
+}
+
+bool
+test_sand_column_across_chunks(void)
+{
+  return test_columns_fall_like_full_scan(PIXEL_TYPE_SAND, TEST_TICKS);
+}
+
+// stops before the water lands and spreads towards the chunk columns' borders
+bool
+test_water_column_across_chunks(void)
+{
+  return test_columns_fall_like_full_scan(PIXEL_TYPE_WATER, TEST_HEIGHT - GRID_CHUNK_SIZE * 2);
+}
+
+// A few cells of every type, in colors of their own as well as the type's.
+void
+test_fill_scene(pixel_buffer_t* buffer)
+{
+  pixel_buffer_init_size(buffer, TEST_WIDTH, TEST_HEIGHT);
+  for (u32 i = 0; i < 200; i++) {
+    pixel_t pixel = { 0 };
+    pixel.col = (i * 37) % TEST_WIDTH;
+    pixel.row = (i * 11) % TEST_HEIGHT;
+    pixel.type = (pixel_type_t)(i % PIXEL_TYPE_COUNT);
+    pixel.color = i % 2 ? pixel_type_to_color(pixel.type) : (SDL_Color){ (u8)i, (u8)(i * 3), 40, 255 };
+    pixel_buffer_add(buffer, pixel);
+  }
+}
+
+bool
+test_same_frame(pixel_buffer_t* a, pixel_buffer_t* b)
+{
+  return a->width == b->width && a->height == b->height && a->count == b->count &&
+         dk_simulation_hash(a) == dk_simulation_hash(b);
+}
+
+bool
+test_write_file(const char* filename, const void* data, sz_t size)
+{
+  FILE* file = fopen(filename, "wb");
+  if (file == NULL) {
+    return false;
+  }
+  bool written = fwrite(data, 1, size, file) == size;
+  return fclose(file) == 0 && written;
+}
+
+// Loading `filename` fails and leaves a frame that already holds a scene as
+// it was.
+bool
+test_load_fails(const char* filename)
+{
+  pixel_buffer_t frame;
+  pixel_buffer_t before;
+  test_fill_scene(&frame);
+  pixel_buffer_init_size(&before, 1, 1);
+  pixel_buffer_copy(&before, &frame);
+
+  bool passed = !pixel_buffer_load(&frame, filename) && test_same_frame(&frame, &before);
+
+  pixel_buffer_destroy(&frame);
+  pixel_buffer_destroy(&before);
+  return passed;
+}
+
+bool
+test_psb_round_trip(void)
+{
+  pixel_buffer_t saved;
+  pixel_buffer_t loaded;
+  test_fill_scene(&saved);
+  pixel_buffer_init_size(&loaded, 1, 1);
+
+  bool passed = pixel_buffer_save(&saved, TEST_FILE_PSB) && pixel_buffer_load(&loaded, TEST_FILE_PSB) &&
+                test_same_frame(&saved, &loaded);
+
+  pixel_buffer_destroy(&saved);
+  pixel_buffer_destroy(&loaded);
+  remove(TEST_FILE_PSB);
+  return passed;
+}
+
+bool
+test_psb_v1(void)
+{
+  // the last record is past the default canvas, the frame grows to fit it
+  pixel_record_t records[] = {
+    { 1, 2, 1, PIXEL_TYPE_SAND, { 10, 20, 30, 255 } },
+    { 3, 4, 1, PIXEL_TYPE_WATER, { 40, 50, 60, 255 } },
+    { GRID_WIDTH + 8, 5, 1, PIXEL_TYPE_FIRE, { 70, 80, 90, 255 } },
+  };
+  u32 count = sizeof(records) / sizeof(records[0]);
+  u8 data[sizeof(u32) + sizeof(records) + 1] = { 0 };
+  memcpy(data, &count, sizeof(u32));
+  memcpy(data + sizeof(u32), records, sizeof(records));
+
+  pixel_buffer_t frame;
+  pixel_buffer_init_size(&frame, 1, 1);
+  bool passed = test_write_file(TEST_FILE_PSB, data, sizeof(u32) + sizeof(records)) &&
+                pixel_buffer_load(&frame, TEST_FILE_PSB) && frame.count == count &&
+                frame.width == GRID_WIDTH + 9 && frame.height == GRID_HEIGHT;
+  for (u32 i = 0; i < count && passed; i++) {
+    pixel_t pixel = pixel_buffer_get_pixel(&frame, records[i].col, records[i].row);
+    passed = pixel.type == records[i].type && pixel__pack_color(pixel.color) == pixel__pack_color(records[i].color);
+  }
+  pixel_buffer_destroy(&frame);
+
+  // a byte too many
+  passed = passed && test_write_file(TEST_FILE_PSB, data, sizeof(data)) && test_load_fails(TEST_FILE_PSB);
+
+  // a type this build does not have, a cell no frame can hold
+  records[1].type = PIXEL_TYPE_COUNT;
+  memcpy(data + sizeof(u32), records, sizeof(records));
+  passed = passed && test_write_file(TEST_FILE_PSB, data, sizeof(u32) + sizeof(records)) &&
+           test_load_fails(TEST_FILE_PSB);
+  records[1].type = PIXEL_TYPE_WATER;
+  records[2].col = UINT32_MAX;
+  memcpy(data + sizeof(u32), records, sizeof(records));
+  passed = passed && test_write_file(TEST_FILE_PSB, data, sizeof(u32) + sizeof(records)) &&
+           test_load_fails(TEST_FILE_PSB);
+
+  remove(TEST_FILE_PSB);
+  return passed;
+}
+
+bool
+test_psb_bad_checksum(void)
+{
+  pixel_buffer_t frame;
+  test_fill_scene(&frame);
+  bool passed = pixel_buffer_save(&frame, TEST_FILE_PSB);
+  pixel_buffer_destroy(&frame);
+
+  u32 size = 0;
+  u8* data = (u8*)dk_read_file(TEST_FILE_PSB, &size);
+  passed = passed && data != NULL && size > PIXEL_PSB_HEADER + 4;
+  if (passed) {
+    data[size / 2] ^= 0x55;
+    passed = test_write_file(TEST_FILE_PSB, data, size) && test_load_fails(TEST_FILE_PSB);
+  }
+
+  free(data);
+  remove(TEST_FILE_PSB);
+  return passed;
+}
+
+bool
+test_psb_not_psb(void)
+{
+  const char text[] = "name,param,density\npixel_buffer_add,1000,0\n";
+  bool passed = test_write_file(TEST_FILE_PSB, text, sizeof(text) - 1) && test_load_fails(TEST_FILE_PSB);
+  remove(TEST_FILE_PSB);
+  return passed;
+}
+
+// palette_uses against a count of the occupied cells
+bool
+test_palette_uses_hold(pixel_buffer_t* buffer)
+{
+  u32 uses[PIXEL_PALETTE_SIZE] = { 0 };
+  for (u32 i = 0; buffer->cells != NULL && i < buffer->width * buffer->height; i++) {
+    if (buffer->cells[i] != GRID_CELL_EMPTY) {
+      uses[buffer->colors[i]]++;
+    }
+  }
+  return memcmp(uses, buffer->palette_uses, sizeof(uses)) == 0;
+}
+
+bool
+test_palette_uses(void)
+{
+  pixel_buffer_t frame;
+  test_fill_scene(&frame);
+  bool passed = test_palette_uses_hold(&frame);
+
+  pixel_t pixel = { 0 };
+  pixel.col = TEST_WIDTH / 2;
+  pixel.row = TEST_HEIGHT / 2;
+  pixel.type = PIXEL_TYPE_SAND;
+  pixel.color = (SDL_Color){ 1, 2, 3, 255 };
+  pixel_buffer_add_circle(&frame, pixel, 9, false);
+  passed = passed && test_palette_uses_hold(&frame);
+  pixel_buffer_add_rect(&frame, pixel, 12, 5, true);
+  passed = passed && test_palette_uses_hold(&frame);
+  pixel_buffer_remove_all(&frame, 0, 0);
+  pixel_buffer_shade_pixel(&frame, 37, 11, 4);
+  passed = passed && test_palette_uses_hold(&frame);
+  pixel_buffer_fill(&frame, pixel, PIXEL_FILL_MATERIAL, false);
+  passed = passed && test_palette_uses_hold(&frame);
+  for (u32 tick = 0; tick < 20; tick++) {
+    dk_simulation_step(&frame);
+  }
+  passed = passed && test_palette_uses_hold(&frame);
+  pixel_buffer_resize(&frame, TEST_WIDTH / 2, TEST_HEIGHT);
+  passed = passed && test_palette_uses_hold(&frame);
+
+  passed = passed && pixel_buffer_save(&frame, TEST_FILE_PSB);
+  pixel_buffer_t loaded;
+  pixel_buffer_init_size(&loaded, 1, 1);
+  passed = passed && pixel_buffer_load(&loaded, TEST_FILE_PSB) && test_palette_uses_hold(&loaded);
+
+  pixel_buffer_destroy(&frame);
+  pixel_buffer_destroy(&loaded);
+  remove(TEST_FILE_PSB);
+  return passed;
+}
+
+// A full palette gives a new color an entry no cell uses anymore, cells keep
+// the colors they show.
+bool
+test_palette_reuses_free_entries(void)
+{
+  pixel_buffer_t frame;
+  pixel_buffer_init_size(&frame, TEST_WIDTH, TEST_HEIGHT);
+  for (u32 i = 0; i < PIXEL_PALETTE_SIZE; i++) {
+    pixel_t pixel = { i % TEST_WIDTH, i / TEST_WIDTH, PIXEL_TYPE_SAND, { (u8)i, 1, 2, 255 } };
+    pixel_buffer_add(&frame, pixel);
+  }
+
+  // nothing free, the nearest entry
+  pixel_t pixel = { 0, TEST_HEIGHT - 1, PIXEL_TYPE_SAND, { 7, 9, 9, 255 } };
+  pixel_buffer_add(&frame, pixel);
+  bool passed = frame.palette_count == PIXEL_PALETTE_SIZE &&
+                pixel__pack_color(pixel_buffer_get_pixel(&frame, 0, TEST_HEIGHT - 1).color) ==
+                  pixel__pack_color((SDL_Color){ 7, 1, 2, 255 });
+
+  for (u32 i = 0; i < PIXEL_PALETTE_SIZE; i += 2) {
+    pixel_buffer_remove_all(&frame, i % TEST_WIDTH, i / TEST_WIDTH);
+  }
+  pixel.col = 1;
+  pixel.color = (SDL_Color){ 200, 200, 200, 255 };
+  pixel_buffer_add(&frame, pixel);
+  passed = passed && frame.palette_count == PIXEL_PALETTE_SIZE &&
+           pixel__pack_color(pixel_buffer_get_pixel(&frame, 1, TEST_HEIGHT - 1).color) ==
+             pixel__pack_color(pixel.color);
+
+  for (u32 i = 1; i < PIXEL_PALETTE_SIZE && passed; i += 2) {
+    SDL_Color color = pixel_buffer_get_pixel(&frame, i % TEST_WIDTH, i / TEST_WIDTH).color;
+    passed = pixel__pack_color(color) == pixel__pack_color((SDL_Color){ (u8)i, 1, 2, 255 });
+  }
+
+  pixel_buffer_destroy(&frame);
+  return passed;
+}
+
+static const test_case_t test_cases[] = {
+  { "sand_column_across_chunks", test_sand_column_across_chunks },
+  { "water_column_across_chunks", test_water_column_across_chunks },
+  { "psb_round_trip", test_psb_round_trip },
+  { "psb_v1", test_psb_v1 },
+  { "psb_bad_checksum", test_psb_bad_checksum },
+  { "psb_not_psb", test_psb_not_psb },
+  { "palette_uses", test_palette_uses },
+  { "palette_reuses_free_entries", test_palette_reuses_free_entries },
+};
+
+int
+main(int argc, char const* argv[])
+{
+  const char* filter = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    }
+  }
+
+  dk_simulation_set_seed(1);
+
+  u32 failed = 0;
+  for (u32 c = 0; c < sizeof(test_cases) / sizeof(test_cases[0]); c++) {
+    const test_case_t* test = &test_cases[c];
+    if (filter != NULL && strstr(test->name, filter) == NULL) {
+      continue;
+    }
+
+    bool passed = test->run();
+    printf("%s %s\n", passed ? "pass" : "FAIL", test->name);
+    failed += !passed;
+  }
+
+  dk_simulation_destroy();
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}